@@ -0,0 +1,69 @@
+// compare the time to remove and insert a fraction of the values one by one
+// with rtree::remove(first, last) and rtree::insert(first, last).
+// usage: bench_batch [number of values] [fraction]
+#include <periortree/rtree.hpp>
+#include <periortree/point.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+typedef perior::point<double, 3>                 point_t;
+typedef perior::rectangle<point_t>               aabb_t;
+typedef perior::cubic_periodic_boundary<point_t> boundary_t;
+typedef std::pair<aabb_t, std::size_t>           value_t;
+typedef perior::rtree<value_t, perior::quadratic<12>, boundary_t> rtree_t;
+
+int main(int argc, char **argv)
+{
+    const std::size_t N = (argc > 1) ? std::atol(argv[1]) : 100000;
+    const double fraction = (argc > 2) ? std::atof(argv[2]) : 0.1;
+
+    const double L = std::cbrt(static_cast<double>(N)); // number density = 1
+    const boundary_t bdry(point_t(0.0, 0.0, 0.0), point_t(L, L, L));
+
+    std::mt19937 mt(123456789);
+    std::uniform_real_distribution<double> uni(0.0, L);
+    std::bernoulli_distribution pick(fraction);
+    std::vector<value_t> values, removed;
+    values.reserve(N);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t center(uni(mt), uni(mt), uni(mt));
+        values.push_back(value_t(aabb_t(center, point_t(0.5, 0.5, 0.5)), i));
+        if(pick(mt)) {removed.push_back(values.back());}
+    }
+
+    rtree_t tree1(values.begin(), values.end(), bdry);
+    const auto single_start = std::chrono::steady_clock::now();
+    for(std::size_t i=0; i<removed.size(); ++i)
+    {
+        tree1.remove(removed[i]);
+    }
+    const auto single_removed = std::chrono::steady_clock::now();
+    for(std::size_t i=0; i<removed.size(); ++i)
+    {
+        tree1.insert(removed[i]);
+    }
+    const auto single_stop = std::chrono::steady_clock::now();
+
+    rtree_t tree2(values.begin(), values.end(), bdry);
+    const auto batch_start = std::chrono::steady_clock::now();
+    tree2.remove(removed.begin(), removed.end());
+    const auto batch_removed = std::chrono::steady_clock::now();
+    tree2.insert(removed.begin(), removed.end());
+    const auto batch_stop = std::chrono::steady_clock::now();
+
+    typedef std::chrono::duration<double> sec;
+    const double t_single_remove = sec(single_removed - single_start).count();
+    const double t_single_insert = sec(single_stop - single_removed).count();
+    const double t_batch_remove  = sec(batch_removed - batch_start).count();
+    const double t_batch_insert  = sec(batch_stop - batch_removed).count();
+    std::cout << "# N = " << N << ", removed = " << removed.size() << '\n';
+    std::cout << "# method remove[sec] insert[sec]\n";
+    std::cout << "one-by-one " << t_single_remove << ' ' << t_single_insert << '\n';
+    std::cout << "batch      " << t_batch_remove  << ' ' << t_batch_insert  << '\n';
+    std::cout << "# speedup " << t_single_remove / t_batch_remove << ' '
+              << t_single_insert / t_batch_insert << std::endl;
+    return 0;
+}
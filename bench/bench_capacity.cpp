@@ -0,0 +1,102 @@
+// build the tree with the node capacity chosen by cache_fit for several
+// numbers of cache lines, and report the insertion and the query throughput.
+// usage: bench_capacity [number of values]
+#include <periortree/rtree.hpp>
+#include <periortree/point.hpp>
+#include <periortree/query.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+typedef perior::point<double, 3>                 point_t;
+typedef perior::rectangle<point_t>               aabb_t;
+typedef perior::cubic_periodic_boundary<point_t> boundary_t;
+typedef std::pair<aabb_t, std::size_t>           value_t;
+
+template<typename Tree>
+double run_query(const Tree& tree, const std::vector<point_t>& centers)
+{
+    std::size_t hits = 0;
+    std::vector<value_t> found;
+    const auto start = std::chrono::steady_clock::now();
+    for(std::size_t i=0; i<centers.size(); ++i)
+    {
+        found.clear();
+        tree.query(perior::query::intersects_box(
+                    aabb_t(centers[i], point_t(1.5, 1.5, 1.5))),
+                   std::back_inserter(found));
+        hits += found.size();
+    }
+    const auto stop  = std::chrono::steady_clock::now();
+    if(hits == 0) {std::cerr << "no hit" << std::endl;}
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+template<typename Params>
+void run(const char* name, const std::vector<value_t>& values,
+         const std::vector<point_t>& centers, const boundary_t& bdry)
+{
+    typedef perior::rtree<value_t, Params, boundary_t> rtree_type;
+
+    const auto start = std::chrono::steady_clock::now();
+    rtree_type inserted(bdry);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        inserted.insert(values[i]);
+    }
+    const auto stop  = std::chrono::steady_clock::now();
+    const double t_insert = std::chrono::duration<double>(stop - start).count();
+
+    const rtree_type packed(values.begin(), values.end(), bdry);
+    const double t_inserted = run_query(inserted, centers);
+    const double t_packed   = run_query(packed,   centers);
+
+    const std::size_t N = values.size();
+    std::cout << name << ' ' << rtree_type::max_entry << ' '
+              << rtree_type::node_size << ' ' << N / t_insert << ' '
+              << centers.size() / t_inserted << ' '
+              << centers.size() / t_packed << std::endl;
+    return;
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t N = (argc > 1) ? std::atol(argv[1]) : 100000;
+
+    const double L = std::cbrt(static_cast<double>(N)); // number density = 1
+    const boundary_t bdry(point_t(0.0, 0.0, 0.0), point_t(L, L, L));
+
+    std::mt19937 mt(123456789);
+    std::uniform_real_distribution<double> uni(0.0, L);
+    std::vector<value_t> values; values.reserve(N);
+    std::vector<point_t> centers; centers.reserve(N);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t center(uni(mt), uni(mt), uni(mt));
+        values.push_back(value_t(aabb_t(center, point_t(0.5, 0.5, 0.5)), i));
+    }
+    for(std::size_t i=0; i<N; ++i)
+    {
+        centers.push_back(point_t(uni(mt), uni(mt), uni(mt)));
+    }
+
+    std::cout << "# N = " << N << '\n';
+    std::cout << "# lines Max node[bytes] inserts/sec "
+                 "queries/sec(inserted) queries/sec(packed)\n";
+    run<perior::cache_fit< 6> >(" 6", values, centers, bdry);
+    run<perior::cache_fit< 8> >(" 8", values, centers, bdry);
+    run<perior::cache_fit<12> >("12", values, centers, bdry);
+    run<perior::cache_fit<16> >("16", values, centers, bdry);
+    run<perior::cache_fit<24> >("24", values, centers, bdry);
+    run<perior::cache_fit<32> >("32", values, centers, bdry);
+    run<perior::cache_fit<64> >("64", values, centers, bdry);
+    std::cout << "# with 32-bit indices and float boxes\n";
+    run<perior::compact_index<perior::reduced_precision<perior::cache_fit< 8> > > >(
+            " 8", values, centers, bdry);
+    run<perior::compact_index<perior::reduced_precision<perior::cache_fit<16> > > >(
+            "16", values, centers, bdry);
+    run<perior::compact_index<perior::reduced_precision<perior::cache_fit<32> > > >(
+            "32", values, centers, bdry);
+    return 0;
+}
@@ -0,0 +1,53 @@
+// insert the values one by one and report the throughput.
+// usage: bench_insert [number of values]
+#include <periortree/rtree.hpp>
+#include <periortree/point.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+typedef perior::point<double, 3>                 point_t;
+typedef perior::rectangle<point_t>               aabb_t;
+typedef perior::cubic_periodic_boundary<point_t> boundary_t;
+typedef std::pair<aabb_t, std::size_t>           value_t;
+
+template<typename Params>
+double run(const std::vector<value_t>& values, const boundary_t& bdry)
+{
+    const auto start = std::chrono::steady_clock::now();
+    perior::rtree<value_t, Params, boundary_t> tree(bdry);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+    const auto stop  = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t N = (argc > 1) ? std::atol(argv[1]) : 200000;
+
+    const double L = std::cbrt(static_cast<double>(N)); // number density = 1
+    const boundary_t bdry(point_t(0.0, 0.0, 0.0), point_t(L, L, L));
+
+    std::mt19937 mt(123456789);
+    std::uniform_real_distribution<double> uni(0.0, L);
+    std::vector<value_t> values; values.reserve(N);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t center(uni(mt), uni(mt), uni(mt));
+        values.push_back(value_t(aabb_t(center, point_t(0.5, 0.5, 0.5)), i));
+    }
+
+    const double t_quad   = run<perior::quadratic<12> >(values, bdry);
+    const double t_linear = run<perior::linear<16>    >(values, bdry);
+    const double t_rstar  = run<perior::rstar<16>     >(values, bdry);
+    std::cout << "# N = " << N << '\n';
+    std::cout << "# algorithm time[sec] inserts/sec\n";
+    std::cout << "quadratic<12> " << t_quad   << ' ' << N / t_quad   << '\n';
+    std::cout << "linear<16>    " << t_linear << ' ' << N / t_linear << '\n';
+    std::cout << "rstar<16>     " << t_rstar  << ' ' << N / t_rstar  << std::endl;
+    return 0;
+}
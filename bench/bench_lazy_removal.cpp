@@ -0,0 +1,91 @@
+// remove and re-add a fraction of the values in each step, with the ordinary
+// removal and with the lazy removal. the total time and the slowest single
+// removal are reported.
+// usage: bench_lazy_removal [number of values] [fraction] [steps]
+#include <periortree/rtree.hpp>
+#include <periortree/point.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+typedef perior::point<double, 3>                 point_t;
+typedef perior::rectangle<point_t>               aabb_t;
+typedef perior::cubic_periodic_boundary<point_t> boundary_t;
+typedef std::pair<aabb_t, std::size_t>           value_t;
+typedef perior::rtree<value_t, perior::quadratic<12>, boundary_t> rtree_t;
+
+struct result_t
+{
+    double total;
+    double slowest;
+};
+
+result_t run(const bool lazy, std::vector<value_t> values, const boundary_t& bdry,
+             const double fraction, const std::size_t steps)
+{
+    typedef std::chrono::duration<double> sec;
+    const double L = bdry.upper()[0];
+    std::mt19937 mt(987654321);
+    std::uniform_real_distribution<double> uni(0.0, L);
+    std::bernoulli_distribution pick(fraction);
+
+    rtree_t tree(bdry);
+    tree.set_lazy_removal(lazy);
+    std::vector<std::size_t> handles;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        handles.push_back(tree.insert(values[i]));
+    }
+
+    result_t r = {0.0, 0.0};
+    for(std::size_t step=0; step<steps; ++step)
+    {
+        for(std::size_t i=0; i<values.size(); ++i)
+        {
+            if(!pick(mt)) {continue;}
+            const auto start = std::chrono::steady_clock::now();
+            tree.remove_handle(handles[i]);
+            const auto stop  = std::chrono::steady_clock::now();
+            r.total  += sec(stop - start).count();
+            r.slowest = std::max(r.slowest, sec(stop - start).count());
+
+            values[i].first.center = point_t(uni(mt), uni(mt), uni(mt));
+            const auto ins_start = std::chrono::steady_clock::now();
+            handles[i] = tree.insert(values[i]);
+            const auto ins_stop  = std::chrono::steady_clock::now();
+            r.total += sec(ins_stop - ins_start).count();
+        }
+    }
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t N = (argc > 1) ? std::atol(argv[1]) : 100000;
+    const double fraction = (argc > 2) ? std::atof(argv[2]) : 0.01;
+    const std::size_t steps = (argc > 3) ? std::atol(argv[3]) : 20;
+
+    const double L = std::cbrt(static_cast<double>(N)); // number density = 1
+    const boundary_t bdry(point_t(0.0, 0.0, 0.0), point_t(L, L, L));
+
+    std::mt19937 mt(123456789);
+    std::uniform_real_distribution<double> uni(0.0, L);
+    std::vector<value_t> values; values.reserve(N);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t center(uni(mt), uni(mt), uni(mt));
+        values.push_back(value_t(aabb_t(center, point_t(0.5, 0.5, 0.5)), i));
+    }
+
+    const result_t eager = run(false, values, bdry, fraction, steps);
+    const result_t lazy  = run(true,  values, bdry, fraction, steps);
+    std::cout << "# N = " << N << ", fraction = " << fraction
+              << ", steps = " << steps << '\n';
+    std::cout << "# method total[sec] slowest removal[sec]\n";
+    std::cout << "eager " << eager.total << ' ' << eager.slowest << '\n';
+    std::cout << "lazy  " << lazy.total  << ' ' << lazy.slowest  << '\n';
+    std::cout << "# speedup " << eager.total / lazy.total << std::endl;
+    return 0;
+}
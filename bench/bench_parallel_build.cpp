@@ -0,0 +1,50 @@
+// measure the time to build an rtree by STR packing with different number of
+// threads. usage: bench_parallel_build [number of values] [max threads]
+#include <periortree/rtree.hpp>
+#include <periortree/point.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <cstdlib>
+
+typedef perior::point<double, 3>                 point_t;
+typedef perior::rectangle<point_t>               aabb_t;
+typedef perior::cubic_periodic_boundary<point_t> boundary_t;
+typedef std::pair<aabb_t, std::size_t>           value_t;
+typedef perior::rtree<value_t, perior::quadratic<12>, boundary_t> rtree_t;
+
+int main(int argc, char **argv)
+{
+    const std::size_t N = (argc > 1) ? std::atol(argv[1]) : 1000000;
+    const std::size_t max_threads = (argc > 2) ? std::atol(argv[2]) :
+        std::max(1u, std::thread::hardware_concurrency());
+
+    const double L = 100.0;
+    const boundary_t bdry(point_t(0.0, 0.0, 0.0), point_t(L, L, L));
+
+    std::mt19937 mt(123456789);
+    std::uniform_real_distribution<double> uni(0.0, L);
+    std::vector<value_t> values; values.reserve(N);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t center(uni(mt), uni(mt), uni(mt));
+        values.push_back(value_t(aabb_t(center, point_t(0.5, 0.5, 0.5)), i));
+    }
+
+    std::cout << "# N = " << N << '\n';
+    std::cout << "# threads time[sec] speedup\n";
+    double serial = 0.0;
+    for(std::size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        rtree_t tree(bdry);
+        const auto start = std::chrono::steady_clock::now();
+        tree.assign(values.begin(), values.end(), perior::str_packing(threads));
+        const auto stop  = std::chrono::steady_clock::now();
+
+        const double t = std::chrono::duration<double>(stop - start).count();
+        if(threads == 1) {serial = t;}
+        std::cout << threads << ' ' << t << ' ' << serial / t << std::endl;
+    }
+    return 0;
+}
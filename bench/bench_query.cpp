@@ -0,0 +1,99 @@
+// run a box query and a spherical query per value and report the throughput,
+// for a tree made by insertion and for a packed tree, with the node boxes in
+// double and in float, and with 32-bit indices.
+// usage: bench_query [number of values]
+#include <periortree/rtree.hpp>
+#include <periortree/point.hpp>
+#include <periortree/query.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+typedef perior::point<double, 3>                 point_t;
+typedef perior::rectangle<point_t>               aabb_t;
+typedef perior::cubic_periodic_boundary<point_t> boundary_t;
+typedef std::pair<aabb_t, std::size_t>           value_t;
+typedef perior::rtree<value_t, perior::quadratic<12>, boundary_t> rtree_t;
+typedef perior::rtree<value_t,
+        perior::reduced_precision<perior::quadratic<12>>, boundary_t> frtree_t;
+typedef perior::rtree<value_t,
+        perior::compact_index<perior::quadratic<12>>, boundary_t> crtree_t;
+
+template<typename Tree>
+double run(const Tree& tree, const std::vector<point_t>& centers,
+           std::size_t& hits)
+{
+    std::vector<value_t> found;
+    const auto start = std::chrono::steady_clock::now();
+    for(std::size_t i=0; i<centers.size(); ++i)
+    {
+        found.clear();
+        tree.query(perior::query::intersects_box(
+                    aabb_t(centers[i], point_t(1.5, 1.5, 1.5))),
+                   std::back_inserter(found));
+        hits += found.size();
+        hits += tree.count(perior::query::within_distance(centers[i], 1.5));
+    }
+    const auto stop  = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t N = (argc > 1) ? std::atol(argv[1]) : 100000;
+
+    const double L = std::cbrt(static_cast<double>(N)); // number density = 1
+    const boundary_t bdry(point_t(0.0, 0.0, 0.0), point_t(L, L, L));
+
+    std::mt19937 mt(123456789);
+    std::uniform_real_distribution<double> uni(0.0, L);
+    std::vector<value_t> values; values.reserve(N);
+    std::vector<point_t> centers; centers.reserve(N);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t center(uni(mt), uni(mt), uni(mt));
+        values.push_back(value_t(aabb_t(center, point_t(0.5, 0.5, 0.5)), i));
+    }
+    for(std::size_t i=0; i<N; ++i)
+    {
+        centers.push_back(point_t(uni(mt), uni(mt), uni(mt)));
+    }
+
+    rtree_t  inserted(bdry);
+    frtree_t finserted(bdry);
+    crtree_t cinserted(bdry);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        inserted.insert(values[i]);
+        finserted.insert(values[i]);
+        cinserted.insert(values[i]);
+    }
+    const rtree_t  packed (values.begin(), values.end(), bdry);
+    const frtree_t fpacked(values.begin(), values.end(), bdry);
+    const crtree_t cpacked(values.begin(), values.end(), bdry);
+
+    std::cout << "# N = " << N << ", 2 queries per value\n";
+    std::cout << "# node size: " << sizeof(rtree_t::node_type) << " bytes, "
+              << sizeof(frtree_t::node_type) << " bytes in float, "
+              << sizeof(crtree_t::node_type) << " bytes with 32-bit indices\n";
+    std::cout << "# tree hits time[sec] queries/sec\n";
+    const auto report = [&](const char* name, const double t, const std::size_t hits)
+    {
+        std::cout << name << ' ' << hits << ' ' << t << ' ' << 2 * N / t << '\n';
+    };
+    std::size_t hits = 0;
+    double t = run(inserted, centers, hits);
+    report("inserted       ", t, hits);
+    hits = 0; t = run(finserted, centers, hits);
+    report("inserted(float)", t, hits);
+    hits = 0; t = run(cinserted, centers, hits);
+    report("inserted(32bit)", t, hits);
+    hits = 0; t = run(packed, centers, hits);
+    report("packed         ", t, hits);
+    hits = 0; t = run(fpacked, centers, hits);
+    report("packed(float)  ", t, hits);
+    hits = 0; t = run(cpacked, centers, hits);
+    report("packed(32bit)  ", t, hits);
+    return 0;
+}
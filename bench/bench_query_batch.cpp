@@ -0,0 +1,67 @@
+// compare the time to run one box query per value one by one and by
+// rtree::query_batch. usage: bench_query_batch [number of values]
+#include <periortree/rtree.hpp>
+#include <periortree/point.hpp>
+#include <periortree/query.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+typedef perior::point<double, 3>                 point_t;
+typedef perior::rectangle<point_t>               aabb_t;
+typedef perior::cubic_periodic_boundary<point_t> boundary_t;
+typedef std::pair<aabb_t, std::size_t>           value_t;
+typedef perior::rtree<value_t, perior::quadratic<12>, boundary_t> rtree_t;
+typedef perior::query::query_intersects_box<point_t> query_t;
+
+int main(int argc, char **argv)
+{
+    const std::size_t N = (argc > 1) ? std::atol(argv[1]) : 100000;
+
+    const double L = std::cbrt(static_cast<double>(N)); // number density = 1
+    const boundary_t bdry(point_t(0.0, 0.0, 0.0), point_t(L, L, L));
+
+    std::mt19937 mt(123456789);
+    std::uniform_real_distribution<double> uni(0.0, L);
+    std::vector<value_t> values; values.reserve(N);
+    std::vector<query_t> queries; queries.reserve(N);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t center(uni(mt), uni(mt), uni(mt));
+        values.push_back(value_t(aabb_t(center, point_t(0.5, 0.5, 0.5)), i));
+    }
+    // the queries are in a random order, unrelated to the tree
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t center(uni(mt), uni(mt), uni(mt));
+        queries.push_back(perior::query::intersects_box(
+                    aabb_t(center, point_t(1.5, 1.5, 1.5))));
+    }
+    const rtree_t tree(values.begin(), values.end(), bdry);
+
+    std::size_t loop_hits = 0;
+    std::vector<value_t> found;
+    const auto loop_start = std::chrono::steady_clock::now();
+    for(std::size_t i=0; i<N; ++i)
+    {
+        found.clear();
+        tree.query(queries[i], std::back_inserter(found));
+        loop_hits += found.size();
+    }
+    const auto loop_stop  = std::chrono::steady_clock::now();
+
+    perior::query::batch_result result;
+    const auto batch_start = std::chrono::steady_clock::now();
+    tree.query_batch(queries.begin(), queries.end(), result);
+    const auto batch_stop  = std::chrono::steady_clock::now();
+
+    const double t_loop  = std::chrono::duration<double>(loop_stop  - loop_start ).count();
+    const double t_batch = std::chrono::duration<double>(batch_stop - batch_start).count();
+    std::cout << "# N = " << N << '\n';
+    std::cout << "# method hits time[sec]\n";
+    std::cout << "loop  " << loop_hits             << ' ' << t_loop  << '\n';
+    std::cout << "batch " << result.indices.size() << ' ' << t_batch << '\n';
+    std::cout << "# speedup " << t_loop / t_batch << std::endl;
+    return 0;
+}
@@ -0,0 +1,87 @@
+// compare the time to list all the pairs within the cutoff by the dual-tree
+// traversal and by one query per value.
+// usage: bench_self_join [number of values] [cutoff]
+#include <periortree/rtree.hpp>
+#include <periortree/point.hpp>
+#include <periortree/query.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+typedef perior::point<double, 3>                 point_t;
+typedef perior::rectangle<point_t>               aabb_t;
+typedef perior::cubic_periodic_boundary<point_t> boundary_t;
+typedef std::pair<aabb_t, std::size_t>           value_t;
+typedef perior::rtree<value_t, perior::quadratic<12>, boundary_t> rtree_t;
+
+struct pair_counter
+{
+    std::size_t* count;
+    void operator()(const value_t&, const value_t&, const point_t&) const
+    {
+        ++(*count);
+    }
+};
+
+struct counter_iterator
+{
+    typedef std::output_iterator_tag iterator_category;
+    typedef void value_type;
+    typedef void difference_type;
+    typedef void pointer;
+    typedef void reference;
+
+    std::size_t self;
+    std::size_t* count;
+    counter_iterator& operator*()     {return *this;}
+    counter_iterator& operator++()    {return *this;}
+    counter_iterator& operator++(int) {return *this;}
+    counter_iterator& operator=(const value_t& v)
+    {
+        if(v.second > self) {++(*count);} // count each pair once
+        return *this;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    const std::size_t N = (argc > 1) ? std::atol(argv[1]) : 100000;
+    const double cutoff = (argc > 2) ? std::atof(argv[2]) : 2.5;
+
+    const double L = std::cbrt(static_cast<double>(N)); // number density = 1
+    const boundary_t bdry(point_t(0.0, 0.0, 0.0), point_t(L, L, L));
+
+    std::mt19937 mt(123456789);
+    std::uniform_real_distribution<double> uni(0.0, L);
+    std::vector<value_t> values; values.reserve(N);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t center(uni(mt), uni(mt), uni(mt));
+        values.push_back(value_t(aabb_t(center, point_t(0.0, 0.0, 0.0)), i));
+    }
+    const rtree_t tree(values.begin(), values.end(), bdry);
+
+    std::size_t dual_count = 0;
+    const auto dual_start = std::chrono::steady_clock::now();
+    tree.for_each_pair_within(cutoff, pair_counter{&dual_count});
+    const auto dual_stop  = std::chrono::steady_clock::now();
+
+    std::size_t query_count = 0;
+    const auto query_start = std::chrono::steady_clock::now();
+    for(std::size_t i=0; i<N; ++i)
+    {
+        tree.query(perior::query::within_distance(values[i].first.center, cutoff),
+                   counter_iterator{i, &query_count});
+    }
+    const auto query_stop  = std::chrono::steady_clock::now();
+
+    const double t_dual  = std::chrono::duration<double>(dual_stop  - dual_start ).count();
+    const double t_query = std::chrono::duration<double>(query_stop - query_start).count();
+    std::cout << "# N = " << N << ", cutoff = " << cutoff << '\n';
+    std::cout << "# method pairs time[sec]\n";
+    std::cout << "dual-tree " << dual_count  << ' ' << t_dual  << '\n';
+    std::cout << "per-value " << query_count << ' ' << t_query << '\n';
+    std::cout << "# speedup " << t_query / t_dual << std::endl;
+    return 0;
+}
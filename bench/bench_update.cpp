@@ -0,0 +1,98 @@
+// compare the time to move all the values by small displacements with
+// remove + insert, with rtree::update, with rtree::update by the handles, and
+// with rtree::update in fattened AABB mode (skin = max displacement).
+// usage: bench_update [number of values] [max displacement]
+#include <periortree/rtree.hpp>
+#include <periortree/point.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+typedef perior::point<double, 3>                 point_t;
+typedef perior::rectangle<point_t>               aabb_t;
+typedef perior::cubic_periodic_boundary<point_t> boundary_t;
+typedef std::pair<aabb_t, std::size_t>           value_t;
+typedef perior::rtree<value_t, perior::quadratic<12>, boundary_t> rtree_t;
+
+int main(int argc, char **argv)
+{
+    const std::size_t N = (argc > 1) ? std::atol(argv[1]) : 100000;
+    const double max_disp = (argc > 2) ? std::atof(argv[2]) : 0.05;
+
+    const double L = std::cbrt(static_cast<double>(N)); // number density = 1
+    const boundary_t bdry(point_t(0.0, 0.0, 0.0), point_t(L, L, L));
+
+    std::mt19937 mt(123456789);
+    std::uniform_real_distribution<double> uni(0.0, L);
+    std::uniform_real_distribution<double> disp(-max_disp, max_disp);
+    std::vector<value_t> values; values.reserve(N);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t center(uni(mt), uni(mt), uni(mt));
+        values.push_back(value_t(aabb_t(center, point_t(0.5, 0.5, 0.5)), i));
+    }
+    std::vector<value_t> moved(values);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_t d(disp(mt), disp(mt), disp(mt));
+        moved[i].first.center = perior::restrict_position(
+                moved[i].first.center + d, bdry);
+    }
+
+    rtree_t tree1(values.begin(), values.end(), bdry);
+    const auto remove_start = std::chrono::steady_clock::now();
+    for(std::size_t i=0; i<N; ++i)
+    {
+        tree1.remove(values[i]);
+        tree1.insert(moved[i]);
+    }
+    const auto remove_stop  = std::chrono::steady_clock::now();
+
+    rtree_t tree2(values.begin(), values.end(), bdry);
+    const auto update_start = std::chrono::steady_clock::now();
+    for(std::size_t i=0; i<N; ++i)
+    {
+        tree2.update(values[i], moved[i]);
+    }
+    const auto update_stop  = std::chrono::steady_clock::now();
+
+    // values in a packed tree are reordered. find the handle of each value.
+    rtree_t tree4(values.begin(), values.end(), bdry);
+    std::vector<std::size_t> handles(N);
+    for(std::size_t h=0; h<N; ++h)
+    {
+        handles.at(tree4.at(h).second) = h;
+    }
+    const auto handle_start = std::chrono::steady_clock::now();
+    for(std::size_t i=0; i<N; ++i)
+    {
+        tree4.update_handle(handles[i], moved[i]);
+    }
+    const auto handle_stop  = std::chrono::steady_clock::now();
+
+    rtree_t tree3(values.begin(), values.end(), bdry);
+    tree3.set_skin(max_disp);
+    const auto skin_start = std::chrono::steady_clock::now();
+    for(std::size_t i=0; i<N; ++i)
+    {
+        tree3.update(values[i], moved[i]);
+    }
+    const auto skin_stop  = std::chrono::steady_clock::now();
+
+    const double t_remove = std::chrono::duration<double>(remove_stop - remove_start).count();
+    const double t_update = std::chrono::duration<double>(update_stop - update_start).count();
+    const double t_handle = std::chrono::duration<double>(handle_stop - handle_start).count();
+    const double t_skin   = std::chrono::duration<double>(skin_stop   - skin_start  ).count();
+    std::cout << "# N = " << N << ", max displacement = " << max_disp << '\n';
+    std::cout << "# method time[sec]\n";
+    std::cout << "remove+insert " << t_remove << '\n';
+    std::cout << "update        " << t_update << '\n';
+    std::cout << "update_handle " << t_handle << '\n';
+    std::cout << "update(skin)  " << t_skin   << '\n';
+    std::cout << "# speedup " << t_remove / t_update << ", by handle "
+              << t_remove / t_handle << ", with skin "
+              << t_remove / t_skin << " (escapes: " << tree3.skin_stats().escapes
+              << '/' << tree3.skin_stats().updates << ")" << std::endl;
+    return 0;
+}
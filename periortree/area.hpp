@@ -2,6 +2,7 @@
 #define PERIOR_TREE_AREA
 #include <periortree/boundary_conditions.hpp>
 #include <periortree/rectangle.hpp>
+#include <algorithm>
 #include <cmath>
 
 namespace perior
@@ -22,5 +23,26 @@ area(const rectangle<pointT>& rec, const boundaryT<pointT>& b)
     return retval;
 }
 
+// area of the rectangle expanded to contain the other one. it is the same as
+// area(expand(lhs, rhs, b), b), but does not make the expanded rectangle.
+template<typename pointT, template<typename> class boundaryT>
+typename boost::enable_if<traits::is_point<pointT>,
+         typename traits::scalar_type_of<pointT>::type>::type
+expanded_area(const rectangle<pointT>& lhs, const rectangle<pointT>& rhs,
+              const boundaryT<pointT>& b) BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typedef typename traits::scalar_type_of<pointT>::type scalar_type;
+    const pointT dc(restrict_direction(rhs.center - lhs.center, b));
+
+    scalar_type retval(1);
+    for(std::size_t i=0; i<traits::dimension<pointT>::value; ++i)
+    {
+        const scalar_type l = std::min(-lhs.radius[i], dc[i] - rhs.radius[i]);
+        const scalar_type u = std::max( lhs.radius[i], dc[i] + rhs.radius[i]);
+        retval *= u - l;
+    }
+    return retval;
+}
+
 }// perior
 #endif//PERIOR_TREE_AREA_HPP
@@ -0,0 +1,86 @@
+#ifndef PERIOR_TREE_DISTANCE
+#define PERIOR_TREE_DISTANCE
+#include <periortree/boundary_conditions.hpp>
+#include <periortree/rectangle.hpp>
+#include <periortree/point_traits.hpp>
+#include <cmath>
+
+namespace perior
+{
+
+// squared distance between the minimum images of the two points.
+template<typename pointT, template<typename> class boundaryT>
+inline typename boost::enable_if<traits::is_point<pointT>,
+         typename traits::scalar_type_of<pointT>::type>::type
+distance_sq(const pointT& lhs, const pointT& rhs, const boundaryT<pointT>& b)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typename traits::scalar_type_of<pointT>::type retval(0);
+    const pointT dr(restrict_direction(lhs - rhs, b));
+    for(std::size_t i=0; i<traits::dimension<pointT>::value; ++i)
+    {
+        retval += dr[i] * dr[i];
+    }
+    return retval;
+}
+
+// squared distance from the point to the nearest image of the rectangle.
+// it is zero if the point is inside of the rectangle.
+template<typename pointT, template<typename> class boundaryT>
+inline typename boost::enable_if<traits::is_point<pointT>,
+         typename traits::scalar_type_of<pointT>::type>::type
+distance_sq(const pointT& p, const rectangle<pointT>& rect,
+            const boundaryT<pointT>& b) BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typedef typename traits::scalar_type_of<pointT>::type scalar_type;
+    scalar_type retval(0);
+    const pointT dc(restrict_direction(p - rect.center, b));
+    for(std::size_t i=0; i<traits::dimension<pointT>::value; ++i)
+    {
+        const scalar_type d = std::abs(dc[i]) - rect.radius[i];
+        if(d > 0)
+        {
+            retval += d * d;
+        }
+    }
+    return retval;
+}
+
+// squared distance between the nearest images of the two rectangles.
+template<typename pointT, template<typename> class boundaryT>
+inline typename boost::enable_if<traits::is_point<pointT>,
+         typename traits::scalar_type_of<pointT>::type>::type
+distance_sq(const rectangle<pointT>& lhs, const rectangle<pointT>& rhs,
+            const boundaryT<pointT>& b) BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typedef typename traits::scalar_type_of<pointT>::type scalar_type;
+    scalar_type retval(0);
+    const pointT dc(restrict_direction(lhs.center - rhs.center, b));
+    for(std::size_t i=0; i<traits::dimension<pointT>::value; ++i)
+    {
+        const scalar_type d = std::abs(dc[i]) - lhs.radius[i] - rhs.radius[i];
+        if(d > 0)
+        {
+            retval += d * d;
+        }
+    }
+    return retval;
+}
+
+namespace detail
+{
+// radius getter that treats every value as a point
+template<typename scalarT>
+struct zero_radius
+{
+    template<typename T>
+    BOOST_FORCEINLINE
+    scalarT operator()(const T&) const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return scalarT(0);
+    }
+};
+} // detail
+
+} // perior
+#endif//PERIOR_TREE_DISTANCE
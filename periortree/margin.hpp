@@ -0,0 +1,26 @@
+#ifndef PERIOR_TREE_MARGIN
+#define PERIOR_TREE_MARGIN
+#include <periortree/boundary_conditions.hpp>
+#include <periortree/rectangle.hpp>
+
+namespace perior
+{
+
+// the sum of the edge lengths of the rectangle (up to a constant factor)
+template<typename pointT, template<typename> class boundaryT>
+typename boost::enable_if<traits::is_point<pointT>,
+         typename traits::scalar_type_of<pointT>::type>::type
+margin(const rectangle<pointT>& rec, const boundaryT<pointT>& b)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typename traits::scalar_type_of<pointT>::type retval(0);
+    for(std::size_t i=0; i<traits::dimension<pointT>::value; ++i)
+    {
+        retval += rec.radius[i] * 2;
+    }
+    assert(retval >= 0);
+    return retval;
+}
+
+}// perior
+#endif//PERIOR_TREE_MARGIN
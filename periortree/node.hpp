@@ -1,29 +1,76 @@
 #ifndef PERIOR_TREE_NODE_HPP
 #define PERIOR_TREE_NODE_HPP
 #include <periortree/rectangle.hpp>
+#include <periortree/boundary_conditions.hpp>
 #include <periortree/containers.hpp>
+#include <boost/math/special_functions/next.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/integer/static_min_max.hpp>
+#include <boost/array.hpp>
+#include <boost/cstdint.hpp>
+#include <limits>
+#include <cmath>
 
 namespace perior
 {
 namespace detail
 {
 
-template<typename pointT, std::size_t Min, std::size_t Max>
-struct rtree_node
+// the alignment of rtree_node. it is the natural one of the members, or
+// Align if that is larger, e.g. the size of a cache line.
+template<typename pointT, std::size_t Max, typename boxScalarT, typename indexT,
+         std::size_t Align>
+struct node_alignment
+{
+    typedef typename gen_static_vector<indexT, Max>::type container_type;
+    static const std::size_t members = boost::static_unsigned_max<
+        boost::static_unsigned_max<boost::alignment_of<pointT>::value,
+                                   boost::alignment_of<boxScalarT>::value>::value,
+        boost::static_unsigned_max<boost::alignment_of<indexT>::value,
+                                   boost::alignment_of<container_type>::value>::value
+        >::value;
+    static const std::size_t value =
+        boost::static_unsigned_max<members, Align>::value;
+};
+
+// boxScalarT is the type of the coordinates in the entry arrays. if it is less
+// precise than the scalar type of the point, the boxes are rounded outward.
+// indexT is the type of the indices of the children, the values and the
+// parent. if Align is given, the node is aligned to it and its size is a
+// multiple of it.
+template<typename pointT, std::size_t Min, std::size_t Max,
+         typename boxScalarT = typename traits::scalar_type_of<pointT>::type,
+         typename indexT = std::size_t, std::size_t Align = 0>
+struct BOOST_ALIGNMENT((node_alignment<pointT, Max, boxScalarT, indexT, Align>::value))
+rtree_node
 {
     typedef pointT point_type;
     BOOST_STATIC_ASSERT(traits::is_point<point_type>::value);
     typedef rectangle<point_type> aabb_type;
+    typedef typename traits::scalar_type_of<point_type>::type scalar_type;
+    typedef boxScalarT box_scalar_type;
+    typedef indexT     index_type;
     static const std::size_t dimension = traits::dimension<point_type>::value;
     static const std::size_t max_entry = Max;
     static const std::size_t min_entry = Min;
 
-    typedef typename gen_static_vector<std::size_t, Max>::type container_type;
+    typedef typename gen_static_vector<index_type, Max>::type container_type;
     typedef typename container_type::iterator       iterator;
     typedef typename container_type::const_iterator const_iterator;
 
-    rtree_node(const bool is_leaf_, const std::size_t parent_)
-        : is_leaf(is_leaf_), parent(parent_)
+    // a coordinate of all the entries
+    typedef boost::array<box_scalar_type, Max> box_array_type;
+
+    // whether the entry arrays keep the boxes as they are
+    static const bool exact_boxes =
+        boost::is_same<box_scalar_type, scalar_type>::value;
+
+    rtree_node(const bool is_leaf_, const std::size_t parent_,
+               const std::size_t level_ = 0)
+        : entry_center(), entry_radius(), entry_volume(),
+          is_leaf(is_leaf_), parent(static_cast<index_type>(parent_)),
+          level(static_cast<index_type>(level_)), dead(0)
     {}
     ~rtree_node(){}
 
@@ -35,12 +82,400 @@ struct rtree_node
     bool has_enough_entry() const BOOST_NOEXCEPT_OR_NOTHROW
     {return this->entry.size() >= min_entry;}
 
+    // the box of the k-th entry, i.e. of the child node or of the value.
+    BOOST_FORCEINLINE
+    aabb_type entry_box(const std::size_t k) const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        aabb_type box;
+        for(std::size_t d=0; d<dimension; ++d)
+        {
+            box.center[d] = this->entry_center[d][k];
+            box.radius[d] = this->entry_radius[d][k];
+        }
+        return box;
+    }
+    BOOST_FORCEINLINE
+    void set_entry_box(const std::size_t k, const aabb_type& box)
+        BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        scalar_type volume(1);
+        for(std::size_t d=0; d<dimension; ++d)
+        {
+            round_outward(box.center[d], box.radius[d],
+                    this->entry_center[d][k], this->entry_radius[d][k]);
+            volume *= static_cast<scalar_type>(this->entry_radius[d][k]) * 2;
+        }
+        this->entry_volume[k] = static_cast<box_scalar_type>(volume);
+        return;
+    }
+
+    // the box as it is stored by set_entry_box
+    static aabb_type stored_box(const aabb_type& box) BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        aabb_type retval;
+        for(std::size_t d=0; d<dimension; ++d)
+        {
+            box_scalar_type c, r;
+            round_outward(box.center[d], box.radius[d], c, r);
+            retval.center[d] = c;
+            retval.radius[d] = r;
+        }
+        return retval;
+    }
+
+    // the center is rounded to the nearest, and the radius is rounded up so
+    // that the rounded box contains the original one.
+    BOOST_FORCEINLINE
+    static void round_outward(const scalar_type c, const scalar_type r,
+            box_scalar_type& c_out, box_scalar_type& r_out)
+        BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        c_out = static_cast<box_scalar_type>(c);
+        if(exact_boxes)
+        {
+            r_out = static_cast<box_scalar_type>(r);
+            return;
+        }
+        const scalar_type error = std::abs(c - static_cast<scalar_type>(c_out));
+        r_out = static_cast<box_scalar_type>(r + error);
+        // r + error itself may be rounded, so go one step further
+        if((error != scalar_type(0) || static_cast<scalar_type>(r_out) < r) &&
+           r_out < std::numeric_limits<box_scalar_type>::max())
+        {
+            r_out = boost::math::float_next(r_out);
+        }
+        return;
+    }
+
+    // the boxes of the entries in structure-of-arrays layout. the k-th entry
+    // has entry_center[d][k] and entry_radius[d][k], and the area of the box
+    // is cached in entry_volume[k]. a node can be tested without touching the
+    // children or the values. they come first so that they start at the
+    // beginning of an aligned node.
+    boost::array<box_array_type, dimension> entry_center;
+    boost::array<box_array_type, dimension> entry_radius;
+    box_array_type                          entry_volume;
+
     bool           is_leaf;
-    std::size_t    parent;
+    index_type     parent;
+    index_type     level; // 0 for leaves
+    index_type     dead;  // number of the dead values in a leaf (lazy removal)
     container_type entry;
     aabb_type      box;
 };
 
+// the largest Max (up to 64) whose node, aligned to Align, is not larger than
+// Bytes. it is 0 if no node fits.
+template<typename pointT, typename boxScalarT, typename indexT,
+         std::size_t Bytes, std::size_t Align, std::size_t Max = 64>
+struct max_entry_fit
+{
+    static const std::size_t value =
+        (sizeof(rtree_node<pointT, 1, Max, boxScalarT, indexT, Align>) <= Bytes) ?
+        Max : max_entry_fit<pointT, boxScalarT, indexT, Bytes, Align, Max - 1>::value;
+};
+template<typename pointT, typename boxScalarT, typename indexT,
+         std::size_t Bytes, std::size_t Align>
+struct max_entry_fit<pointT, boxScalarT, indexT, Bytes, Align, 0>
+{
+    static const std::size_t value = 0;
+};
+
+// the functions below test a box against all the entries of a node at once.
+// the loop runs over all the Max slots without any branch, so that compilers
+// can vectorize it across the entries (with -O3, SSE2 by default and AVX2 or
+// AVX-512 with -march=native). the slots not in use are masked out at the end.
+// bit k of the result corresponds to the k-th entry.
+
+typedef boost::uint64_t entry_mask_type;
+
+template<std::size_t Max>
+BOOST_FORCEINLINE
+entry_mask_type entry_mask(const std::size_t n) BOOST_NOEXCEPT_OR_NOTHROW
+{
+    BOOST_STATIC_ASSERT_MSG(Max <= 64, "rtree_node: too many entries");
+    return (n == 64) ? ~entry_mask_type(0) : (entry_mask_type(1) << n) - 1;
+}
+
+// |dx| between the minimum images. it is the same as restrict_direction,
+// but without branch. w is the width of the boundary along the axis.
+template<typename T, typename pointT>
+BOOST_FORCEINLINE T
+axis_distance(const T dx, const T, const unlimited_boundary<pointT>&)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    return std::abs(dx);
+}
+template<typename T, typename pointT>
+BOOST_FORCEINLINE T
+axis_distance(const T dx, const T w, const cubic_periodic_boundary<pointT>&)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    const T adx     = std::abs(dx);
+    const T wrapped = std::abs(w - adx);
+    return (wrapped < adx) ? wrapped : adx;
+}
+
+template<typename T, typename pointT>
+BOOST_FORCEINLINE T
+boundary_width(const unlimited_boundary<pointT>&, const std::size_t)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    return T(0);
+}
+template<typename T, typename pointT>
+BOOST_FORCEINLINE T
+boundary_width(const cubic_periodic_boundary<pointT>& b, const std::size_t i)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    return static_cast<T>(b.width()[i]);
+}
+
+// the kernels run in box_scalar_type. if it is less precise than the point,
+// the query is rounded outward once, and each gap is lowered by a bound of
+// the errors, tolerance * (|center| + |query center| + width + radii), so that
+// no entry that matches in scalar_type is missed. the errors include the
+// rounding of the boxes themselves, so the gap raised by the same bound tells
+// the entries whose original boxes surely match. with 8 epsilons the bound
+// holds with a margin.
+template<typename nodeT>
+BOOST_FORCEINLINE typename nodeT::box_scalar_type
+kernel_tolerance() BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typedef typename nodeT::box_scalar_type box_scalar_type;
+    return nodeT::exact_boxes ? box_scalar_type(0) :
+           8 * std::numeric_limits<box_scalar_type>::epsilon();
+}
+
+// a rectangle in the form that intersects_mask uses. it is made once per
+// query, not for each node.
+template<typename nodeT>
+struct kernel_box
+{
+    typedef typename nodeT::point_type      point_type;
+    typedef typename nodeT::box_scalar_type box_scalar_type;
+    typedef boost::array<box_scalar_type, nodeT::dimension> array_type;
+
+    kernel_box(): center(), radius(), width(), slack() {}
+
+    template<typename boundaryT>
+    kernel_box(const rectangle<point_type>& rect, const boundaryT& b)
+    {
+        const box_scalar_type tol = kernel_tolerance<nodeT>();
+        for(std::size_t i=0; i<nodeT::dimension; ++i)
+        {
+            nodeT::round_outward(rect.center[i], rect.radius[i],
+                                 center[i], radius[i]);
+            width[i] = boundary_width<box_scalar_type>(b, i);
+            slack[i] = tol * (std::abs(center[i]) + width[i] + radius[i]);
+        }
+    }
+
+    array_type center, radius, width, slack;
+};
+
+// a sphere in the form that within_distance_mask uses.
+template<typename nodeT>
+struct kernel_sphere
+{
+    typedef typename nodeT::point_type      point_type;
+    typedef typename nodeT::scalar_type     scalar_type;
+    typedef typename nodeT::box_scalar_type box_scalar_type;
+    typedef boost::array<box_scalar_type, nodeT::dimension> array_type;
+
+    kernel_sphere(): center(), width(), slack(), radius_sq(0), sure_radius_sq(0)
+    {}
+
+    template<typename boundaryT>
+    kernel_sphere(const point_type& p, const scalar_type r_sq, const boundaryT& b)
+    {
+        // the error in the center is a part of the slack.
+        const box_scalar_type tol = kernel_tolerance<nodeT>();
+        for(std::size_t i=0; i<nodeT::dimension; ++i)
+        {
+            box_scalar_type error;
+            nodeT::round_outward(p[i], scalar_type(0), center[i], error);
+            width[i] = boundary_width<box_scalar_type>(b, i);
+            slack[i] = tol * (std::abs(center[i]) + width[i]) + error;
+        }
+        // the sum of the squares has the relative error of a few epsilons.
+        const scalar_type upper = r_sq * (1 + tol);
+        const scalar_type lower = r_sq * (1 - tol);
+        radius_sq      = static_cast<box_scalar_type>(upper);
+        sure_radius_sq = static_cast<box_scalar_type>(lower);
+        if(static_cast<scalar_type>(radius_sq) < upper &&
+           radius_sq < std::numeric_limits<box_scalar_type>::max())
+        {
+            radius_sq = boost::math::float_next(radius_sq);
+        }
+        if(static_cast<scalar_type>(sure_radius_sq) > lower)
+        {
+            sure_radius_sq = (sure_radius_sq > std::numeric_limits<box_scalar_type>::max()) ?
+                std::numeric_limits<box_scalar_type>::max() :
+                boost::math::float_prior(sure_radius_sq);
+        }
+    }
+
+    array_type      center, width, slack;
+    box_scalar_type radius_sq, sure_radius_sq;
+};
+
+// the entries whose boxes intersect with the rectangle.
+// the result is the same as intersects(node.entry_box(k), rect, b) if the
+// boxes are exact. otherwise, it may contain several more entries. sure has
+// the entries whose original boxes, before the rounding, surely intersect.
+template<typename pointT, std::size_t Min, std::size_t Max, typename boxScalarT,
+         typename indexT, std::size_t Align, typename boundaryT>
+inline entry_mask_type
+intersects_mask(const rtree_node<pointT, Min, Max, boxScalarT, indexT, Align>& node,
+    const kernel_box<rtree_node<pointT, Min, Max, boxScalarT, indexT, Align> >& q,
+    const boundaryT& b, entry_mask_type& sure) BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typedef rtree_node<pointT, Min, Max, boxScalarT, indexT, Align> node_type;
+    typedef typename node_type::box_scalar_type box_scalar_type;
+    typedef typename node_type::box_array_type  array_type;
+    const std::size_t dim = node_type::dimension;
+    const box_scalar_type tol = kernel_tolerance<node_type>();
+
+    // the largest gap between the boxes along the axes
+    array_type gap, sure_gap;
+    for(std::size_t k=0; k<Max; ++k)
+    {
+        box_scalar_type gk = -std::numeric_limits<box_scalar_type>::max();
+        box_scalar_type sk = gk;
+        for(std::size_t i=0; i<dim; ++i)
+        {
+            const box_scalar_type c = node.entry_center[i][k];
+            const box_scalar_type r = node.entry_radius[i][k];
+            const box_scalar_type g =
+                axis_distance(c - q.center[i], q.width[i], b) - (r + q.radius[i]);
+            box_scalar_type lo = g;
+            if(!node_type::exact_boxes)
+            {
+                const box_scalar_type e  = q.slack[i] + tol * (std::abs(c) + r);
+                const box_scalar_type hi = g + e;
+                sk = (sk < hi) ? hi : sk;
+                lo -= e;
+            }
+            gk = (gk < lo) ? lo : gk;
+        }
+        gap[k]      = gk;
+        sure_gap[k] = sk;
+    }
+    entry_mask_type mask = 0;
+    sure = 0;
+    for(std::size_t k=0; k<Max; ++k)
+    {
+        mask |= entry_mask_type(gap[k] <= box_scalar_type(0)) << k;
+    }
+    for(std::size_t k=0; k<Max && !node_type::exact_boxes; ++k)
+    {
+        sure |= entry_mask_type(sure_gap[k] <= box_scalar_type(0)) << k;
+    }
+    const entry_mask_type used = entry_mask<Max>(node.entry.size());
+    sure = node_type::exact_boxes ? (mask & used) : (sure & used);
+    return mask & used;
+}
+template<typename pointT, std::size_t Min, std::size_t Max, typename boxScalarT,
+         typename indexT, std::size_t Align, typename boundaryT>
+inline entry_mask_type
+intersects_mask(const rtree_node<pointT, Min, Max, boxScalarT, indexT, Align>& node,
+    const kernel_box<rtree_node<pointT, Min, Max, boxScalarT, indexT, Align> >& q,
+    const boundaryT& b) BOOST_NOEXCEPT_OR_NOTHROW
+{
+    entry_mask_type sure;
+    return intersects_mask(node, q, b, sure);
+}
+template<typename pointT, std::size_t Min, std::size_t Max, typename boxScalarT,
+         typename indexT, std::size_t Align, typename boundaryT>
+inline entry_mask_type
+intersects_mask(const rtree_node<pointT, Min, Max, boxScalarT, indexT, Align>& node,
+                const rectangle<pointT>& rect, const boundaryT& b)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typedef rtree_node<pointT, Min, Max, boxScalarT, indexT, Align> node_type;
+    return intersects_mask(node, kernel_box<node_type>(rect, b), b);
+}
+
+// the entries whose boxes are within the distance from the point.
+// the result is the same as distance_sq(p, node.entry_box(k), b) <= r_sq if
+// the boxes are exact. otherwise, it may contain several more entries. sure has
+// the entries whose original boxes are surely within the distance.
+template<typename pointT, std::size_t Min, std::size_t Max, typename boxScalarT,
+         typename indexT, std::size_t Align, typename boundaryT>
+inline entry_mask_type
+within_distance_mask(const rtree_node<pointT, Min, Max, boxScalarT, indexT, Align>& node,
+    const kernel_sphere<rtree_node<pointT, Min, Max, boxScalarT, indexT, Align> >& q,
+    const boundaryT& b, entry_mask_type& sure) BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typedef rtree_node<pointT, Min, Max, boxScalarT, indexT, Align> node_type;
+    typedef typename node_type::box_scalar_type box_scalar_type;
+    typedef typename node_type::box_array_type  array_type;
+    const std::size_t dim = node_type::dimension;
+    const box_scalar_type tol = kernel_tolerance<node_type>();
+
+    array_type dist_sq, sure_dist_sq;
+    for(std::size_t k=0; k<Max; ++k)
+    {
+        box_scalar_type dk(0), sk(0);
+        for(std::size_t i=0; i<dim; ++i)
+        {
+            const box_scalar_type c = node.entry_center[i][k];
+            const box_scalar_type r = node.entry_radius[i][k];
+            const box_scalar_type d =
+                axis_distance(c - q.center[i], q.width[i], b) - r;
+            box_scalar_type lo = d;
+            if(!node_type::exact_boxes)
+            {
+                const box_scalar_type e  = q.slack[i] + tol * (std::abs(c) + r);
+                const box_scalar_type hi = d + e;
+                const box_scalar_type gh = (hi + std::abs(hi)) / 2;
+                sk += gh * gh;
+                lo -= e;
+            }
+            // max(d, 0). it is exact, and gcc does not vectorize the
+            // conditional with SSE2.
+            const box_scalar_type gl = (lo + std::abs(lo)) / 2;
+            dk += gl * gl;
+        }
+        dist_sq[k]      = dk;
+        sure_dist_sq[k] = sk;
+    }
+    entry_mask_type mask = 0;
+    sure = 0;
+    for(std::size_t k=0; k<Max; ++k)
+    {
+        mask |= entry_mask_type(dist_sq[k] <= q.radius_sq) << k;
+    }
+    for(std::size_t k=0; k<Max && !node_type::exact_boxes; ++k)
+    {
+        sure |= entry_mask_type(sure_dist_sq[k] <= q.sure_radius_sq) << k;
+    }
+    const entry_mask_type used = entry_mask<Max>(node.entry.size());
+    sure = node_type::exact_boxes ? (mask & used) : (sure & used);
+    return mask & used;
+}
+template<typename pointT, std::size_t Min, std::size_t Max, typename boxScalarT,
+         typename indexT, std::size_t Align, typename boundaryT>
+inline entry_mask_type
+within_distance_mask(const rtree_node<pointT, Min, Max, boxScalarT, indexT, Align>& node,
+    const kernel_sphere<rtree_node<pointT, Min, Max, boxScalarT, indexT, Align> >& q,
+    const boundaryT& b) BOOST_NOEXCEPT_OR_NOTHROW
+{
+    entry_mask_type sure;
+    return within_distance_mask(node, q, b, sure);
+}
+template<typename pointT, std::size_t Min, std::size_t Max, typename boxScalarT,
+         typename indexT, std::size_t Align, typename boundaryT>
+inline entry_mask_type
+within_distance_mask(const rtree_node<pointT, Min, Max, boxScalarT, indexT, Align>& node,
+        const pointT& p, const typename traits::scalar_type_of<pointT>::type r_sq,
+        const boundaryT& b) BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typedef rtree_node<pointT, Min, Max, boxScalarT, indexT, Align> node_type;
+    return within_distance_mask(node, kernel_sphere<node_type>(p, r_sq, b), b);
+}
+
 } // detail
 } // perior
 #endif//PERIOR_TREE_NODE_HPP
@@ -0,0 +1,38 @@
+#ifndef PERIOR_TREE_OVERLAP
+#define PERIOR_TREE_OVERLAP
+#include <periortree/boundary_conditions.hpp>
+#include <periortree/rectangle.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace perior
+{
+
+// the area of the intersection of two rectangles. on the periodic cell, the
+// images nearest to each other are considered.
+template<typename pointT, template<typename> class boundaryT>
+typename boost::enable_if<traits::is_point<pointT>,
+         typename traits::scalar_type_of<pointT>::type>::type
+overlap(const rectangle<pointT>& lhs, const rectangle<pointT>& rhs,
+        const boundaryT<pointT>& b) BOOST_NOEXCEPT_OR_NOTHROW
+{
+    typedef typename traits::scalar_type_of<pointT>::type scalar_type;
+
+    const pointT dc(restrict_direction(lhs.center - rhs.center, b));
+    scalar_type retval(1);
+    for(std::size_t i=0; i<traits::dimension<pointT>::value; ++i)
+    {
+        const scalar_type len = std::min(
+                lhs.radius[i] + rhs.radius[i] - std::abs(dc[i]),
+                std::min(lhs.radius[i], rhs.radius[i]) * 2);
+        if(len <= 0)
+        {
+            return scalar_type(0);
+        }
+        retval *= len;
+    }
+    return retval;
+}
+
+}// perior
+#endif//PERIOR_TREE_OVERLAP
@@ -0,0 +1,489 @@
+#ifndef PERIOR_TREE_PACKING_HPP
+#define PERIOR_TREE_PACKING_HPP
+#include <periortree/point_traits.hpp>
+#include <periortree/boundary_conditions.hpp>
+#include <boost/config.hpp>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 201103L
+#include <thread>
+#endif
+
+namespace perior
+{
+
+// Sort-Tile-Recursive packing (Leutenegger et al. 1997).
+// if threads > 1, the tree is built in parallel (requires C++11).
+struct str_packing
+{
+    str_packing(): threads(1){}
+    explicit str_packing(const std::size_t n): threads(n == 0 ? 1 : n){}
+
+    std::size_t threads;
+};
+
+// sort the values along a space-filling curve and pack them in that order.
+// morton (Z-order) curve is cheaper to compute but has larger jumps.
+struct hilbert_packing {};
+struct morton_packing  {};
+
+namespace detail
+{
+
+// compares std::pair<point, index> by the coordinate of the point.
+template<typename pointT>
+struct center_less
+{
+    explicit center_less(const std::size_t ax): axis(ax){}
+
+    template<typename T>
+    BOOST_FORCEINLINE bool operator()(const std::pair<pointT, T>& lhs,
+                                      const std::pair<pointT, T>& rhs) const
+        BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return lhs.first[axis] < rhs.first[axis];
+    }
+
+    std::size_t axis;
+};
+
+template<typename RandomAccessIterator, typename pointT>
+BOOST_FORCEINLINE void
+cut_at_widest_gap(RandomAccessIterator, RandomAccessIterator,
+                  const std::size_t, const unlimited_boundary<pointT>&)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    return;
+}
+
+// on a torus, the sequence of sorted coordinates is a circle. it is cut at the
+// widest gap (possibly the one across the boundary) so that a tile does not
+// straddle the boundary unless the entries do not leave any space there.
+template<typename RandomAccessIterator, typename pointT>
+void cut_at_widest_gap(RandomAccessIterator first, RandomAccessIterator last,
+                       const std::size_t axis,
+                       const cubic_periodic_boundary<pointT>& b)
+{
+    typedef typename traits::scalar_type_of<pointT>::type scalar_type;
+    if(std::distance(first, last) < 2)
+    {
+        return;
+    }
+
+    RandomAccessIterator cut(first);
+    scalar_type widest = first->first[axis] + b.width()[axis] -
+                         (last - 1)->first[axis];
+    for(RandomAccessIterator i(first + 1); i != last; ++i)
+    {
+        const scalar_type gap = i->first[axis] - (i - 1)->first[axis];
+        if(widest < gap)
+        {
+            widest = gap;
+            cut    = i;
+        }
+    }
+    std::rotate(first, cut, last);
+    return;
+}
+
+// sort entries along the axis. the centers should already be restricted.
+template<typename RandomAccessIterator, typename boundaryT>
+void sort_along(RandomAccessIterator first, RandomAccessIterator last,
+                const std::size_t axis, const boundaryT& b)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type
+            entry_type;
+    typedef typename entry_type::first_type point_type;
+
+    std::sort(first, last, center_less<point_type>(axis));
+    cut_at_widest_gap(first, last, axis, b);
+    return;
+}
+
+// the number of slabs along the current axis. remaining is the number of
+// axes that are not sorted yet, including the current one.
+BOOST_FORCEINLINE std::size_t
+str_slab_count(const std::size_t n_groups, const std::size_t remaining)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    std::size_t s = 1;
+    while(true)
+    {
+        std::size_t pow = 1;
+        for(std::size_t i=0; i<remaining; ++i)
+        {
+            pow *= s;
+            if(pow >= n_groups) {return s;}
+        }
+        ++s;
+    }
+}
+
+// how str_partition cuts n entries along the axis. the i-th slab is
+// [n * i / slabs, n * (i+1) / slabs) and is cut along next_axis. str_partition
+// and str_tile_count both follow this, so the number of tiles counted in
+// advance is always the number of tiles made.
+template<std::size_t Max>
+struct str_cut
+{
+    str_cut(const std::size_t n_, const std::size_t axis, const std::size_t dim)
+        BOOST_NOEXCEPT_OR_NOTHROW
+        : n(n_), slabs(0), next_axis((axis + 1 == dim) ? axis : axis + 1)
+    {
+        const std::size_t n_groups = (n + Max - 1) / Max;
+        slabs = (axis + 1 == dim) ? n_groups : str_slab_count(n_groups, dim - axis);
+    }
+
+    BOOST_FORCEINLINE
+    std::size_t slab_first(const std::size_t i) const BOOST_NOEXCEPT_OR_NOTHROW
+    {return n * i / slabs;}
+    BOOST_FORCEINLINE
+    std::size_t slab_last(const std::size_t i) const BOOST_NOEXCEPT_OR_NOTHROW
+    {return n * (i + 1) / slabs;}
+
+    std::size_t n;
+    std::size_t slabs;
+    std::size_t next_axis;
+};
+
+// reorder the entries [first, last) and append the end of each tile (as an
+// offset from `origin`) to `ends`. every tile has at most Max entries and, if
+// there are more than Max entries in total, at least Max/2 entries.
+template<std::size_t Max, typename RandomAccessIterator, typename boundaryT>
+void str_partition(RandomAccessIterator first, RandomAccessIterator last,
+                   const RandomAccessIterator origin, const std::size_t axis,
+                   const boundaryT& b, std::vector<std::size_t>& ends)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type
+            entry_type;
+    typedef typename entry_type::first_type point_type;
+    const std::size_t dim = traits::dimension<point_type>::value;
+
+    const std::size_t n = std::distance(first, last);
+    if(n <= Max)
+    {
+        ends.push_back(std::distance(origin, last));
+        return;
+    }
+
+    const str_cut<Max> cut(n, axis, dim);
+    sort_along(first, last, axis, b);
+    for(std::size_t i=0; i<cut.slabs; ++i)
+    {
+        str_partition<Max>(first + cut.slab_first(i), first + cut.slab_last(i),
+                           origin, cut.next_axis, b, ends);
+    }
+    return;
+}
+
+// the number of tiles that str_partition makes from n entries.
+template<std::size_t Max, std::size_t Dim>
+std::size_t str_tile_count(const std::size_t n, const std::size_t axis)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    if(n <= Max)
+    {
+        return 1;
+    }
+    const str_cut<Max> cut(n, axis, Dim);
+    std::size_t count = 0;
+    for(std::size_t i=0; i<cut.slabs; ++i)
+    {
+        count += str_tile_count<Max, Dim>(
+                cut.slab_last(i) - cut.slab_first(i), cut.next_axis);
+    }
+    return count;
+}
+
+#if __cplusplus >= 201103L
+// sort each part in a thread and merge them pairwise.
+template<typename RandomAccessIterator, typename Compare>
+void parallel_sort(RandomAccessIterator first, RandomAccessIterator last,
+                   Compare comp, const std::size_t threads)
+{
+    const std::size_t n = std::distance(first, last);
+    if(threads < 2 || n < threads * 1024)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::vector<std::size_t> bounds(threads + 1);
+    for(std::size_t i=0; i<=threads; ++i)
+    {
+        bounds[i] = n * i / threads;
+    }
+    {
+        std::vector<std::thread> workers;
+        for(std::size_t t=0; t<threads; ++t)
+        {
+            workers.emplace_back([=]{
+                std::sort(first + bounds[t], first + bounds[t+1], comp);
+            });
+        }
+        for(auto& w : workers) {w.join();}
+    }
+    for(std::size_t width=1; width < threads; width *= 2)
+    {
+        std::vector<std::thread> workers;
+        for(std::size_t t=0; t + width < threads; t += 2 * width)
+        {
+            const std::size_t lower  = bounds[t];
+            const std::size_t middle = bounds[t + width];
+            const std::size_t upper  = bounds[std::min(t + 2 * width, threads)];
+            workers.emplace_back([=]{
+                std::inplace_merge(first + lower, first + middle, first + upper,
+                                   comp);
+            });
+        }
+        for(auto& w : workers) {w.join();}
+    }
+    return;
+}
+#endif // cpp11
+
+// split n entries into ceil(n / Max) consecutive groups of almost the same
+// size. if n > Max, every group has at least Max/2 entries.
+template<std::size_t Max>
+void chunk_partition(const std::size_t n, std::vector<std::size_t>& ends)
+{
+    const std::size_t n_groups = (n + Max - 1) / Max;
+    for(std::size_t i=0; i<n_groups; ++i)
+    {
+        ends.push_back(n * (i + 1) / n_groups);
+    }
+    return;
+}
+
+// ----------------------------------------------------------------------------
+// space-filling curves
+
+// maps a (restricted) point onto the integer lattice that the curve runs on.
+template<typename pointT>
+struct curve_grid
+{
+    typedef typename traits::scalar_type_of<pointT>::type scalar_type;
+    BOOST_STATIC_CONSTEXPR std::size_t dimension = traits::dimension<pointT>::value;
+    BOOST_STATIC_CONSTEXPR std::size_t bits =
+        (64 / dimension > 31) ? 31 : 64 / dimension;
+
+    boost::uint32_t operator()(const pointT& p, const std::size_t i) const
+        BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        scalar_type u = p[i] - origin[i];
+        if(u < 0) {u += width[i];}
+        const scalar_type q = u * scale[i];
+        const scalar_type last = static_cast<scalar_type>((1u << bits) - 1);
+        return static_cast<boost::uint32_t>(q < 0 ? 0 : (q > last ? last : q));
+    }
+
+    pointT origin, width, scale;
+};
+
+// for unlimited boundary, the lattice covers the bounding box of the points.
+template<typename RandomAccessIterator, typename pointT>
+curve_grid<pointT>
+make_curve_grid(RandomAccessIterator first, RandomAccessIterator last,
+                const unlimited_boundary<pointT>&)
+{
+    typedef curve_grid<pointT> grid_type;
+    typedef typename grid_type::scalar_type scalar_type;
+
+    grid_type grid;
+    pointT upper(first->first);
+    grid.origin = first->first;
+    for(RandomAccessIterator i(first); i != last; ++i)
+    {
+        for(std::size_t d=0; d<grid_type::dimension; ++d)
+        {
+            grid.origin[d] = std::min(grid.origin[d], i->first[d]);
+            upper[d]       = std::max(upper[d],       i->first[d]);
+        }
+    }
+    for(std::size_t d=0; d<grid_type::dimension; ++d)
+    {
+        const scalar_type w = upper[d] - grid.origin[d];
+        grid.width[d] = (w > 0) ? w : scalar_type(1);
+        grid.scale[d] = static_cast<scalar_type>(1u << grid_type::bits) /
+                        grid.width[d];
+    }
+    return grid;
+}
+
+// on the periodic cell, the origin of each axis is moved into the widest
+// empty region found in a histogram of the coordinates. the only jump of the
+// curve across the boundary then lies where no value exists, so the ordering
+// is continuous on the torus as far as the values are concerned.
+template<typename RandomAccessIterator, typename pointT>
+curve_grid<pointT>
+make_curve_grid(RandomAccessIterator first, RandomAccessIterator last,
+                const cubic_periodic_boundary<pointT>& b)
+{
+    typedef curve_grid<pointT> grid_type;
+    typedef typename grid_type::scalar_type scalar_type;
+    const std::size_t n_bins = 1024;
+
+    grid_type grid;
+    std::vector<bool> occupied(n_bins);
+    for(std::size_t d=0; d<grid_type::dimension; ++d)
+    {
+        const scalar_type bin_width = b.width()[d] / n_bins;
+        std::fill(occupied.begin(), occupied.end(), false);
+        for(RandomAccessIterator i(first); i != last; ++i)
+        {
+            const std::size_t bin = std::min(n_bins - 1, static_cast<std::size_t>(
+                        (i->first[d] - b.lower()[d]) / bin_width));
+            occupied[bin] = true;
+        }
+
+        // find the longest circular run of empty bins.
+        // the grid starts from the first occupied bin after the run.
+        std::size_t start = 0, longest = 0, run = 0;
+        for(std::size_t j=0; j < 2 * n_bins && run < n_bins; ++j)
+        {
+            if(occupied[j % n_bins])
+            {
+                if(longest < run)
+                {
+                    longest = run;
+                    start   = j % n_bins;
+                }
+                run = 0;
+            }
+            else
+            {
+                ++run;
+            }
+        }
+        grid.origin[d] = b.lower()[d] + start * bin_width;
+        grid.width[d]  = b.width()[d];
+        grid.scale[d]  = static_cast<scalar_type>(1u << grid_type::bits) /
+                         b.width()[d];
+    }
+    return grid;
+}
+
+// Skilling, J. (2004) "Programming the Hilbert curve", AIP Conf. Proc. 707.
+// convert the coordinates into the transposed form of the hilbert index.
+template<std::size_t N>
+void hilbert_transpose(boost::array<boost::uint32_t, N>& x, const std::size_t bits)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    const boost::uint32_t M = 1u << (bits - 1);
+    for(boost::uint32_t Q = M; Q > 1; Q >>= 1)
+    {
+        const boost::uint32_t P = Q - 1;
+        for(std::size_t i=0; i<N; ++i)
+        {
+            if(x[i] & Q)
+            {
+                x[0] ^= P;
+            }
+            else
+            {
+                const boost::uint32_t t = (x[0] ^ x[i]) & P;
+                x[0] ^= t;
+                x[i] ^= t;
+            }
+        }
+    }
+    for(std::size_t i=1; i<N; ++i)
+    {
+        x[i] ^= x[i-1];
+    }
+    boost::uint32_t t = 0;
+    for(boost::uint32_t Q = M; Q > 1; Q >>= 1)
+    {
+        if(x[N-1] & Q) {t ^= Q - 1;}
+    }
+    for(std::size_t i=0; i<N; ++i)
+    {
+        x[i] ^= t;
+    }
+    return;
+}
+
+template<std::size_t N>
+BOOST_FORCEINLINE boost::uint64_t
+interleave_bits(const boost::array<boost::uint32_t, N>& x, const std::size_t bits)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+    boost::uint64_t key = 0;
+    for(std::size_t j=bits; j != 0; --j)
+    {
+        for(std::size_t i=0; i<N; ++i)
+        {
+            key = (key << 1) | ((x[i] >> (j - 1)) & 1u);
+        }
+    }
+    return key;
+}
+
+template<typename pointT>
+boost::uint64_t curve_key(const pointT& p, const curve_grid<pointT>& grid,
+                          hilbert_packing)
+{
+    const std::size_t N = curve_grid<pointT>::dimension;
+    boost::array<boost::uint32_t, N> x;
+    for(std::size_t i=0; i<N; ++i)
+    {
+        x[i] = grid(p, i);
+    }
+    hilbert_transpose(x, curve_grid<pointT>::bits);
+    return interleave_bits(x, curve_grid<pointT>::bits);
+}
+
+template<typename pointT>
+boost::uint64_t curve_key(const pointT& p, const curve_grid<pointT>& grid,
+                          morton_packing)
+{
+    const std::size_t N = curve_grid<pointT>::dimension;
+    boost::array<boost::uint32_t, N> x;
+    for(std::size_t i=0; i<N; ++i)
+    {
+        x[i] = grid(p, i);
+    }
+    return interleave_bits(x, curve_grid<pointT>::bits);
+}
+
+// sort entries (std::pair<point, index>) along the curve.
+template<typename RandomAccessIterator, typename boundaryT, typename Curve>
+void sort_along_curve(RandomAccessIterator first, RandomAccessIterator last,
+                      const boundaryT& b, const Curve curve)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type
+            entry_type;
+    typedef typename entry_type::first_type point_type;
+
+    if(first == last)
+    {
+        return;
+    }
+    const curve_grid<point_type> grid = make_curve_grid(first, last, b);
+
+    std::vector<std::pair<boost::uint64_t, std::size_t> > keys;
+    keys.reserve(std::distance(first, last));
+    for(RandomAccessIterator i(first); i != last; ++i)
+    {
+        keys.push_back(std::make_pair(curve_key(i->first, grid, curve),
+                                      keys.size()));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<entry_type> sorted;
+    sorted.reserve(keys.size());
+    for(std::size_t i=0; i<keys.size(); ++i)
+    {
+        sorted.push_back(*(first + keys[i].second));
+    }
+    std::copy(sorted.begin(), sorted.end(), first);
+    return;
+}
+
+} // detail
+} // perior
+#endif//PERIOR_TREE_PACKING_HPP
@@ -0,0 +1,137 @@
+#ifndef PERIOR_TREE_PARAMETERS_HPP
+#define PERIOR_TREE_PARAMETERS_HPP
+#include <boost/config.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/mpl/has_xxx.hpp>
+#include <boost/cstdint.hpp>
+#include <cstddef>
+
+namespace perior
+{
+
+struct quadratic_tag {};
+struct linear_tag    {};
+struct rstar_tag     {};
+
+// Guttman's quadratic split. it costs O(Max^2) for each split.
+template<std::size_t Max, std::size_t Min = Max / 3>
+struct quadratic
+{
+    typedef quadratic_tag algorithm_tag;
+    BOOST_STATIC_CONSTEXPR std::size_t min_entry = Min;
+    BOOST_STATIC_CONSTEXPR std::size_t max_entry = Max;
+};
+
+// Guttman's linear split. it costs O(Max) for each split, so it is suitable
+// for large nodes, although the nodes overlap more than quadratic.
+template<std::size_t Max, std::size_t Min = Max / 3>
+struct linear
+{
+    typedef linear_tag algorithm_tag;
+    BOOST_STATIC_CONSTEXPR std::size_t min_entry = Min;
+    BOOST_STATIC_CONSTEXPR std::size_t max_entry = Max;
+};
+
+// R*-tree (Beckmann et al. 1990). the subtree is chosen by the overlap
+// enlargement at the leaf level, the split is chosen by margin and overlap,
+// and Reinsert entries are re-inserted once per level before a node is split.
+template<std::size_t Max, std::size_t Min = Max * 3 / 10,
+         std::size_t Reinsert = Max * 3 / 10>
+struct rstar
+{
+    typedef rstar_tag algorithm_tag;
+    BOOST_STATIC_CONSTEXPR std::size_t min_entry      = Min;
+    BOOST_STATIC_CONSTEXPR std::size_t max_entry      = Max;
+    BOOST_STATIC_CONSTEXPR std::size_t reinsert_entry = Reinsert;
+    BOOST_STATIC_ASSERT_MSG(Reinsert + Min <= Max + 1,
+            "rstar: too many entries to be re-inserted");
+};
+
+// chooses Max so that a node fits in Lines cache lines of LineSize bytes, e.g.
+// cache_fit<4, rstar_tag> is rstar<Max> with the largest Max whose node is not
+// larger than 256 bytes. the size of a node depends on the point type and on
+// the other parameters, so rtree derives Max and exposes it as max_entry.
+// the nodes are aligned to LineSize, so each node occupies exactly its lines.
+// Min and Reinsert are the defaults of the algorithm.
+template<std::size_t Lines, typename AlgorithmTag = quadratic_tag,
+         std::size_t LineSize = 64>
+struct cache_fit
+{
+    typedef cache_fit    cache_fit_type;
+    typedef AlgorithmTag algorithm_tag;
+    BOOST_STATIC_CONSTEXPR std::size_t lines      = Lines;
+    BOOST_STATIC_CONSTEXPR std::size_t line_size  = LineSize;
+    BOOST_STATIC_CONSTEXPR std::size_t node_bytes = Lines * LineSize;
+};
+
+// keeps the boxes in the nodes in Scalar, e.g. reduced_precision<quadratic<12>>
+// stores them in float. the boxes are rounded outward, so the nodes are
+// pruned conservatively, and the values are tested in the original precision.
+template<typename Params, typename Scalar = float>
+struct reduced_precision : public Params
+{
+    typedef Scalar node_scalar_type;
+};
+
+// stores the indices of the nodes and the values in Index, e.g.
+// compact_index<quadratic<12>> uses 32-bit indices. the tree can hold less
+// than std::numeric_limits<Index>::max() values and nodes.
+template<typename Params, typename Index = boost::uint32_t>
+struct compact_index : public Params
+{
+    typedef Index node_index_type;
+};
+
+namespace detail
+{
+BOOST_MPL_HAS_XXX_TRAIT_DEF(node_scalar_type)
+BOOST_MPL_HAS_XXX_TRAIT_DEF(node_index_type)
+BOOST_MPL_HAS_XXX_TRAIT_DEF(cache_fit_type)
+
+template<typename Params, typename Scalar,
+         bool = has_node_scalar_type<Params>::value>
+struct node_scalar_of
+{
+    typedef Scalar type;
+};
+template<typename Params, typename Scalar>
+struct node_scalar_of<Params, Scalar, true>
+{
+    typedef typename Params::node_scalar_type type;
+};
+
+template<typename Params, bool = has_node_index_type<Params>::value>
+struct node_index_of
+{
+    typedef std::size_t type;
+};
+template<typename Params>
+struct node_index_of<Params, true>
+{
+    typedef typename Params::node_index_type type;
+};
+
+// the alignment of the nodes. 0 means the natural one.
+template<typename Params, bool = has_cache_fit_type<Params>::value>
+struct node_alignment_of
+{
+    BOOST_STATIC_CONSTEXPR std::size_t value = 0;
+};
+template<typename Params>
+struct node_alignment_of<Params, true>
+{
+    BOOST_STATIC_CONSTEXPR std::size_t value = Params::cache_fit_type::line_size;
+};
+
+// the parameters of the algorithm with the default Min
+template<typename AlgorithmTag, std::size_t Max> struct default_parameters;
+template<std::size_t Max>
+struct default_parameters<quadratic_tag, Max> {typedef quadratic<Max> type;};
+template<std::size_t Max>
+struct default_parameters<linear_tag,    Max> {typedef linear<Max>    type;};
+template<std::size_t Max>
+struct default_parameters<rstar_tag,     Max> {typedef rstar<Max>     type;};
+} // detail
+
+} // perior
+#endif//PERIOR_TREE_PARAMETERS_HPP
@@ -28,7 +28,7 @@ struct point
     template<typename ...Ts,
         typename boost::enable_if_c<sizeof...(Ts) == dimension, std::nullptr_t
             >::type = nullptr>
-    point(Ts&& ... xs) noexcept : values_{{std::forward<scalar_type>(xs)...}}{}
+    point(Ts&& ... xs) noexcept : values_{{static_cast<scalar_type>(xs)...}}{}
 
     point(std::initializer_list<scalar_type> il)
     {
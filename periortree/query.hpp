@@ -4,7 +4,10 @@
 #include <periortree/boundary_conditions.hpp>
 #include <periortree/rectangle.hpp>
 #include <periortree/intersects.hpp>
+#include <periortree/within.hpp>
+#include <periortree/distance.hpp>
 #include <boost/static_assert.hpp>
+#include <vector>
 
 namespace perior
 {
@@ -41,6 +44,15 @@ struct query_intersects_box
         return true;
     }
 
+    // whether the node might contain a value that matches
+    template<typename boundaryT>
+    BOOST_FORCEINLINE
+    bool match_node(const rectangle<pointT>& r, boundaryT const& b)
+        const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return ::perior::intersects(r, rect, b);
+    }
+
     BOOST_FORCEINLINE
     rectangle<pointT> const& box() const BOOST_NOEXCEPT_OR_NOTHROW
     {
@@ -79,15 +91,109 @@ struct query_within_box
         return true;
     }
 
+    // whether the node might contain a value that matches
+    template<typename boundaryT>
+    BOOST_FORCEINLINE
+    bool match_node(const rectangle<pointT>& r, boundaryT const& b)
+        const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return ::perior::intersects(r, rect, b);
+    }
+
+    BOOST_FORCEINLINE
+    rectangle<pointT> const& box() const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return rect;
+    }
+
+    rectangle<pointT> rect;
+};
+
+// values within the distance from the center. the nodes are pruned by the
+// distance from the center to their boxes, not by the bounding cube.
+template<typename pointT>
+struct query_within_distance
+{
+    BOOST_STATIC_ASSERT(::perior::traits::is_point<pointT>::value);
+    typedef typename ::perior::traits::scalar_type_of<pointT>::type scalar_type;
+
+    query_within_distance(const pointT& c, const scalar_type r)
+        : center(c), radius(r), radius_sq(r * r)
+    {
+        for(std::size_t i=0; i < ::perior::traits::dimension<pointT>::value; ++i)
+        {
+            this->rect.center[i] = c[i];
+            this->rect.radius[i] = r;
+        }
+    }
+
+    template<typename boundaryT>
+    BOOST_FORCEINLINE
+    bool match(const pointT& p, boundaryT const& b) const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return ::perior::distance_sq(p, center, b) <= radius_sq;
+    }
+
+    template<typename boundaryT>
+    BOOST_FORCEINLINE
+    bool match(const rectangle<pointT>& r, boundaryT const& b)
+        const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return ::perior::distance_sq(center, r, b) <= radius_sq;
+    }
+
+    template<typename T>
+    BOOST_FORCEINLINE
+    bool match(T const& r) const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return true;
+    }
+
+    template<typename boundaryT>
+    BOOST_FORCEINLINE
+    bool match_node(const rectangle<pointT>& r, boundaryT const& b)
+        const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return ::perior::distance_sq(center, r, b) <= radius_sq;
+    }
+
+    // the bounding cube of the sphere
     BOOST_FORCEINLINE
     rectangle<pointT> const& box() const BOOST_NOEXCEPT_OR_NOTHROW
     {
         return rect;
     }
 
+    pointT            center;
+    scalar_type       radius;
+    scalar_type       radius_sq;
     rectangle<pointT> rect;
 };
 
+// k nearest values from the point. rtree::query outputs
+// std::pair<value_type, scalar_type>, the value and its distance from the
+// point, in the order of increasing distance.
+template<typename pointT>
+struct query_nearest
+{
+    BOOST_STATIC_ASSERT(::perior::traits::is_point<pointT>::value);
+
+    query_nearest(const pointT& p, const std::size_t n): point(p), k(n){}
+
+    pointT      point;
+    std::size_t k;
+};
+
+// the result of rtree::query_batch in CSR format. the values that match the
+// i-th query are rtree::at(indices[j]) for j in [offsets[i], offsets[i+1]).
+struct batch_result
+{
+    std::size_t size() const {return offsets.empty() ? 0 : offsets.size() - 1;}
+
+    std::vector<std::size_t> offsets;
+    std::vector<std::size_t> indices;
+};
+
 template<typename pointT>
 inline typename boost::enable_if<
     ::perior::traits::is_point<pointT>, query_intersects_box<pointT> >::type
@@ -98,12 +204,29 @@ intersects_box(rectangle<pointT> const& rect)
 
 template<typename pointT>
 inline typename boost::enable_if<
-    ::perior::traits::is_point<pointT>, query_intersects_box<pointT> >::type
+    ::perior::traits::is_point<pointT>, query_within_box<pointT> >::type
 within_box(rectangle<pointT> const& rect)
 {
     return query_within_box<pointT>(rect);
 }
 
+template<typename pointT>
+inline typename boost::enable_if<
+    ::perior::traits::is_point<pointT>, query_within_distance<pointT> >::type
+within_distance(pointT const& center,
+        typename ::perior::traits::scalar_type_of<pointT>::type const radius)
+{
+    return query_within_distance<pointT>(center, radius);
+}
+
+template<typename pointT>
+inline typename boost::enable_if<
+    ::perior::traits::is_point<pointT>, query_nearest<pointT> >::type
+nearest(pointT const& p, const std::size_t k)
+{
+    return query_nearest<pointT>(p, k);
+}
+
 } // query
 } // perior
 #endif//PERIOR_TREE_QUERY_H
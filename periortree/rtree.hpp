@@ -7,22 +7,131 @@
 #include <periortree/expand.hpp>
 #include <periortree/within.hpp>
 #include <periortree/area.hpp>
+#include <periortree/distance.hpp>
+#include <periortree/query.hpp>
 #include <periortree/to_svg.hpp>
 #include <periortree/containers.hpp>
+#include <periortree/packing.hpp>
+#include <periortree/parameters.hpp>
+#include <periortree/split.hpp>
 
 #include <boost/optional.hpp>
+#include <boost/align/aligned_allocator_adaptor.hpp>
+#include <boost/type_traits/conditional.hpp>
+#include <boost/cstdint.hpp>
+#include <numeric>
+#include <queue>
+#include <iterator>
+#include <stdexcept>
 #include <limits>
+#include <climits>
+
+#if __cplusplus >= 201103L
+#include <periortree/thread_pool.hpp>
+#include <exception>
+#include <thread>
+#endif
 
 namespace perior
 {
+namespace detail
+{
+struct rtree_access;
+
+// position of the lowest set bit. x should not be 0.
+BOOST_FORCEINLINE std::size_t lowest_bit(const boost::uint64_t x)
+    BOOST_NOEXCEPT_OR_NOTHROW
+{
+#if defined(__GNUC__)
+    return static_cast<std::size_t>(__builtin_ctzll(x));
+#else
+    std::size_t n = 0;
+    while(((x >> n) & 1u) == 0) {++n;}
+    return n;
+#endif
+}
+
+// Params itself, or the parameters with the Max chosen by cache_fit
+template<typename Params, typename pointT, typename boxScalarT, typename indexT,
+         bool = has_cache_fit_type<Params>::value>
+struct fit_parameters
+{
+    typedef Params type;
+};
+template<typename Params, typename pointT, typename boxScalarT, typename indexT>
+struct fit_parameters<Params, pointT, boxScalarT, indexT, true>
+{
+    typedef typename Params::cache_fit_type fit_type;
+    BOOST_STATIC_CONSTEXPR std::size_t max_entry = max_entry_fit<pointT,
+        boxScalarT, indexT, fit_type::node_bytes, fit_type::line_size>::value;
+    BOOST_STATIC_ASSERT_MSG(max_entry >= 4,
+            "cache_fit: the cache lines cannot hold a node with 4 entries");
+    typedef typename default_parameters<
+        typename fit_type::algorithm_tag, max_entry>::type type;
+};
+
+// a query together with the form of it that the node kernels use.
+template<typename Query, typename Kernel>
+struct kernel_query : public Query
+{
+    explicit kernel_query(const Query& q): Query(q), kernel() {}
+    kernel_query(const Query& q, const Kernel& k): Query(q), kernel(k) {}
+
+    Kernel kernel;
+};
+
+// the type of Query in the traversal. the query that has a kernel is rounded
+// once at the beginning, not at each node.
+template<typename nodeT, typename Query>
+struct kernel_query_of
+{
+    typedef Query type;
+
+    template<typename boundaryT>
+    static Query const& make(const Query& q, const boundaryT&) {return q;}
+};
+template<typename nodeT, typename pointT>
+struct kernel_query_of<nodeT, query::query_intersects_box<pointT> >
+{
+    typedef kernel_query<query::query_intersects_box<pointT>,
+                         kernel_box<nodeT> > type;
+
+    template<typename boundaryT>
+    static type make(const query::query_intersects_box<pointT>& q,
+                     const boundaryT& b)
+    {
+        return type(q, kernel_box<nodeT>(q.rect, b));
+    }
+};
+template<typename nodeT, typename pointT>
+struct kernel_query_of<nodeT, query::query_within_box<pointT> >
+{
+    typedef kernel_query<query::query_within_box<pointT>,
+                         kernel_box<nodeT> > type;
 
-template<std::size_t Max, std::size_t Min = Max / 3>
-struct quadratic
+    template<typename boundaryT>
+    static type make(const query::query_within_box<pointT>& q,
+                     const boundaryT& b)
+    {
+        return type(q, kernel_box<nodeT>(q.rect, b));
+    }
+};
+template<typename nodeT, typename pointT>
+struct kernel_query_of<nodeT, query::query_within_distance<pointT> >
 {
-    static constexpr std::size_t min_entry = Min;
-    static constexpr std::size_t max_entry = Max;
+    typedef kernel_query<query::query_within_distance<pointT>,
+                         kernel_sphere<nodeT> > type;
+
+    template<typename boundaryT>
+    static type make(const query::query_within_distance<pointT>& q,
+                     const boundaryT& b)
+    {
+        return type(q, kernel_sphere<nodeT>(q.center, q.radius_sq, b));
+    }
 };
 
+} // detail
+
 template<typename T,
          typename Params,
          typename Boundary,
@@ -33,7 +142,6 @@ class rtree
 {
   public:
     typedef T               value_type;
-    typedef Params          parameter_type;
     typedef Boundary        boundary_type;
     typedef IndexableGetter indexable_getter_type;
     typedef EqualTo         equal_to_type;
@@ -43,36 +151,83 @@ class rtree
     typedef typename traits::point_type_of<indexable_type>::type  point_type;
     typedef typename traits::scalar_type_of<indexable_type>::type scalar_type;
 
+    typedef typename detail::node_scalar_of<Params, scalar_type>::type
+            node_scalar_type;
+    typedef typename detail::node_index_of<Params>::type
+            node_index_type;
+    BOOST_STATIC_ASSERT_MSG(boost::is_unsigned<node_index_type>::value &&
+            sizeof(node_index_type) <= sizeof(std::size_t),
+            "rtree: the index type should be an unsigned integer");
+
+    // Params, or the parameters derived from it by cache_fit
+    typedef typename detail::fit_parameters<Params, point_type,
+            node_scalar_type, node_index_type>::type parameter_type;
+    typedef typename parameter_type::algorithm_tag algorithm_tag;
+
     BOOST_STATIC_CONSTEXPR std::size_t dimension = traits::dimension<point_type>::value;
     BOOST_STATIC_CONSTEXPR std::size_t min_entry = parameter_type::min_entry;
     BOOST_STATIC_CONSTEXPR std::size_t max_entry = parameter_type::max_entry;
+    BOOST_STATIC_ASSERT_MSG(min_entry * 2 <= max_entry,
+            "rtree: min_entry should be less than or equal to max_entry / 2");
+    BOOST_STATIC_ASSERT_MSG(max_entry <= 64,
+            "rtree: the entries of a node are tested by a 64-bit mask");
 
     typedef boost::container::vector<value_type, allocator_type> container_type;
     typedef typename container_type::iterator       iterator;
     typedef typename container_type::const_iterator const_iterator;
 
-    typedef detail::rtree_node<point_type, min_entry, max_entry> node_type;
-    typedef typename node_type::aabb_type aabb_type;
+    // 0, or the size of a cache line with cache_fit
+    BOOST_STATIC_CONSTEXPR std::size_t node_alignment =
+        detail::node_alignment_of<Params>::value;
 
-    typedef typename allocator_type::template rebind<node_type>::other
-            node_allocator_type;
-    typedef typename allocator_type::template rebind<std::size_t>::other
-            size_t_allocator_type;
+    typedef detail::rtree_node<point_type, min_entry, max_entry,
+            node_scalar_type, node_index_type, node_alignment> node_type;
+    BOOST_STATIC_CONSTEXPR std::size_t node_size = sizeof(node_type);
+    typedef typename node_type::aabb_type aabb_type;
+    typedef detail::entry_mask_type       entry_mask_type;
+
+    // the allocator does not need to support the over-aligned nodes.
+    typedef typename boost::conditional<(node_alignment == 0),
+            typename allocator_type::template rebind<node_type>::other,
+            boost::alignment::aligned_allocator_adaptor<
+                typename allocator_type::template rebind<node_type>::other,
+                node_alignment>
+        >::type node_allocator_type;
+    typedef typename allocator_type::template rebind<node_index_type>::other
+            index_allocator_type;
     typedef typename gen_vector<node_type, node_allocator_type>::type tree_type;
-    typedef typename gen_small_vector<std::size_t, 8, size_t_allocator_type
+    typedef typename gen_small_vector<node_index_type, 8, index_allocator_type
         >::type index_buffer_type;
 
-    BOOST_STATIC_CONSTEXPR std::size_t nil = std::numeric_limits<std::size_t>::max();
+    // the largest index. no value or node has it.
+    BOOST_STATIC_CONSTEXPR std::size_t nil =
+        std::numeric_limits<node_index_type>::max();
+
+    // counters of update() in the fattened AABB mode
+    struct skin_statistics
+    {
+        skin_statistics(): updates(0), escapes(0){}
+
+        std::size_t updates; // number of update() calls
+        std::size_t escapes; // number of values that went out of the fat box
+    };
 
   public:
 
-    rtree(): root_(nil){}
+    rtree(): root_(nil), reinserted_levels_(0), skin_(0), exact_recheck_(true),
+             lazy_removal_(false), max_dead_(min_entry), num_dead_(0)
+    {}
     ~rtree(){}
     rtree(const rtree& rhs)
         : root_(rhs.root_), equal_to_(rhs.equal_to_), boundary_(rhs.boundary_),
           tree_(rhs.tree_), container_(rhs.container_),
           overwritable_values_(rhs.overwritable_values_),
-          overwritable_nodes_(rhs.overwritable_nodes_)
+          overwritable_nodes_(rhs.overwritable_nodes_),
+          reinserted_levels_(rhs.reinserted_levels_),
+          leaf_of_(rhs.leaf_of_), fat_boxes_(rhs.fat_boxes_), skin_(rhs.skin_),
+          exact_recheck_(rhs.exact_recheck_), skin_stats_(rhs.skin_stats_),
+          dead_(rhs.dead_), lazy_removal_(rhs.lazy_removal_),
+          max_dead_(rhs.max_dead_), num_dead_(rhs.num_dead_)
     {}
     rtree& operator=(const rtree& rhs)
     {
@@ -83,17 +238,78 @@ class rtree
         container_ = rhs.container_;
         overwritable_values_ = rhs.overwritable_values_;
         overwritable_nodes_  = rhs.overwritable_nodes_;
+        reinserted_levels_   = rhs.reinserted_levels_;
+        leaf_of_             = rhs.leaf_of_;
+        fat_boxes_           = rhs.fat_boxes_;
+        skin_                = rhs.skin_;
+        exact_recheck_       = rhs.exact_recheck_;
+        skin_stats_          = rhs.skin_stats_;
+        dead_                = rhs.dead_;
+        lazy_removal_        = rhs.lazy_removal_;
+        max_dead_            = rhs.max_dead_;
+        num_dead_            = rhs.num_dead_;
         return *this;
     }
 
-    explicit rtree(const boundary_type& b): root_(nil), boundary_(b){}
-    explicit rtree(const equal_to_type& e): root_(nil), equal_to_(e){}
+    explicit rtree(const boundary_type& b)
+        : root_(nil), boundary_(b), reinserted_levels_(0),
+          skin_(0), exact_recheck_(true),
+          lazy_removal_(false), max_dead_(min_entry), num_dead_(0)
+    {}
+    explicit rtree(const equal_to_type& e)
+        : root_(nil), equal_to_(e), reinserted_levels_(0),
+          skin_(0), exact_recheck_(true),
+          lazy_removal_(false), max_dead_(min_entry), num_dead_(0)
+    {}
     rtree(const boundary_type& b, const equal_to_type& e)
-        : root_(nil), equal_to_(e), boundary_(b)
+        : root_(nil), equal_to_(e), boundary_(b), reinserted_levels_(0),
+          skin_(0), exact_recheck_(true),
+          lazy_removal_(false), max_dead_(min_entry), num_dead_(0)
     {}
 
-    std::size_t size() const BOOST_NOEXCEPT_OR_NOTHROW {return container_.size();}
-    bool empty()       const BOOST_NOEXCEPT_OR_NOTHROW {return this->root_ == nil;}
+    // construct packed tree from the range by Sort-Tile-Recursive algorithm.
+    template<typename InputIterator>
+    rtree(InputIterator first, InputIterator last, const boundary_type& b)
+        : root_(nil), boundary_(b), reinserted_levels_(0),
+          skin_(0), exact_recheck_(true),
+          lazy_removal_(false), max_dead_(min_entry), num_dead_(0)
+    {
+        this->assign(first, last);
+    }
+    // construct packed tree by the specified algorithm. Packing is one of
+    // str_packing, hilbert_packing, and morton_packing.
+    template<typename InputIterator, typename Packing>
+    rtree(InputIterator first, InputIterator last, const boundary_type& b,
+          const Packing& packing)
+        : root_(nil), boundary_(b), reinserted_levels_(0),
+          skin_(0), exact_recheck_(true),
+          lazy_removal_(false), max_dead_(min_entry), num_dead_(0)
+    {
+        this->assign(first, last, packing);
+    }
+
+    std::size_t size() const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return container_.size() - overwritable_values_.size() - num_dead_;
+    }
+    bool empty()       const BOOST_NOEXCEPT_OR_NOTHROW {return this->size() == 0;}
+
+    boundary_type const& boundary() const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return this->boundary_;
+    }
+    // the value stored at the index, e.g. the one reported by spatial_join
+    // with index_pairs or the handle returned by insert.
+    value_type const& at(const std::size_t idx) const
+    {
+        return this->container_.at(idx);
+    }
+    // true if the handle points to a value in the tree.
+    bool contains(const std::size_t handle) const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return handle < leaf_of_.size() && leaf_of_[handle] != nil &&
+               !this->is_dead(handle);
+    }
     void clear()
     {
         this->root_ = nil;
@@ -101,28 +317,142 @@ class rtree
         this->container_.clear();
         this->overwritable_nodes_.clear();
         this->overwritable_values_.clear();
+        this->leaf_of_.clear();
+        this->fat_boxes_.clear();
+        this->dead_.clear();
+        this->num_dead_ = 0;
         return;
     }
 
-    void insert(const value_type& v)
+    // fattened AABB mode. each value is stored in leaves with its box inflated
+    // by the skin. update() does not touch the tree until the box of the value
+    // goes out of the inflated one. if exact_recheck is false, queries test
+    // the inflated boxes at the leaves, so the result may contain the values
+    // that do not match exactly. setting the skin to 0 disables this mode.
+    void set_skin(const scalar_type skin, const bool exact_recheck = true)
     {
-        const std::size_t     idx   = this->add_value(v);
-        const indexable_type& entry = indexable_getter_(v);
-        const std::size_t     L     = this->choose_leaf(entry);
-
-        if(tree_.at(L).has_enough_storage())
+        this->skin_          = skin;
+        this->exact_recheck_ = exact_recheck;
+        this->fat_boxes_.clear();
+        if(skin > 0)
         {
-            tree_.at(L).entry.push_back(idx);
-            tree_.at(L).box = expand(tree_.at(L).box, entry, this->boundary_);
-            this->adjust_tree(L);
+            this->fat_boxes_.reserve(this->container_.size());
+            for(typename container_type::const_iterator
+                    i(container_.begin()), e(container_.end()); i != e; ++i)
+            {
+                this->fat_boxes_.push_back(this->fatten(*i));
+            }
         }
-        else
+        if(this->root_ != nil)
         {
-            const std::size_t LL = this->add_node(this->split_leaf(L, idx, entry));
-            this->adjust_tree(L, LL);
+            this->refit(this->root_);
+        }
+        return;
+    }
+    scalar_type skin() const BOOST_NOEXCEPT_OR_NOTHROW {return this->skin_;}
+
+    skin_statistics const& skin_stats() const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return this->skin_stats_;
+    }
+    void reset_skin_stats() BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        this->skin_stats_ = skin_statistics();
+    }
+
+    // lazy removal mode. remove() only marks the value as dead and queries
+    // skip it. when a leaf has more than max_dead dead values, they are
+    // erased from the leaf and the tree is condensed there. disabling this
+    // mode compacts the whole tree.
+    void set_lazy_removal(const bool enable, const std::size_t max_dead = min_entry)
+    {
+        this->lazy_removal_ = enable;
+        this->max_dead_     = max_dead;
+        if(!enable)
+        {
+            this->compact();
         }
         return;
     }
+    bool lazy_removal() const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return this->lazy_removal_;
+    }
+    // number of the dead values that are not erased yet
+    std::size_t num_dead() const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return this->num_dead_;
+    }
+    // erase all the dead values and condense the tree.
+    void compact()
+    {
+        if(this->num_dead_ == 0) {return;}
+
+        std::vector<std::size_t> dirty;
+        for(std::size_t i=0; i<this->dead_.size(); ++i)
+        {
+            if(this->dead_[i]) {dirty.push_back(this->leaf_of_[i]);}
+        }
+        std::sort(dirty.begin(), dirty.end());
+        dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+        for(std::vector<std::size_t>::const_iterator
+                i(dirty.begin()), e(dirty.end()); i != e; ++i)
+        {
+            this->purge_leaf(*i);
+        }
+        return this->condense_batch(dirty);
+    }
+
+    // discard all the values and construct a packed tree from the range.
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last)
+    {
+        return this->assign(first, last, str_packing());
+    }
+
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last, str_packing packing)
+    {
+        packing_buffer_type entries;
+        if(!this->prepare_packing(first, last, entries))
+        {
+            return;
+        }
+#if __cplusplus >= 201103L
+        if(packing.threads > 1)
+        {
+            return this->assign_str_parallel(entries, packing.threads);
+        }
+#endif
+        std::vector<std::size_t> ends;
+        detail::str_partition<max_entry>(entries.begin(), entries.end(),
+                entries.begin(), 0, this->boundary_, ends);
+        this->build_leaves(entries, ends);
+        return this->build_upper_levels(entries);
+    }
+
+    // pack the values in the order along hilbert or morton curve. container_
+    // is also sorted in that order.
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last, hilbert_packing)
+    {
+        return this->assign_along_curve(first, last, hilbert_packing());
+    }
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last, morton_packing)
+    {
+        return this->assign_along_curve(first, last, morton_packing());
+    }
+
+    // returns the handle of the value. it is the index in the container and
+    // remains valid until the value is removed or the tree is re-packed.
+    std::size_t insert(const value_type& v)
+    {
+        const std::size_t idx = this->add_value(v);
+        this->reinserted_levels_ = 0;
+        this->insert_value(idx);
+        return idx;
+    }
     // if found, erase and return true. if not found, return false.
     bool remove(const value_type& v)
     {
@@ -130,195 +460,1446 @@ class rtree
         {
             return false;
         }
-        boost::optional<
-            std::pair<std::size_t, typename node_type::const_iterator>
-            > found = this->find_leaf(this->root_, v);
+        const boost::optional<leaf_entry_type> found =
+            this->find_leaf(this->root_, v);
         if(found)
         {
-            const std::size_t node_idx  =   found->first;
-            const std::size_t value_idx = *(found->second);
-            this->tree_.at(node_idx).entry.erase(found->second);
-            this->erase_value(value_idx);
-            this->condense_box(this->tree_.at(node_idx));
-            this->condense_leaf(node_idx);
+            this->remove_entry(*found);
             return true;
         }
         return false;
     }
-
-    template<typename Query, typename OutputIterator>
-    void query(Query q, OutputIterator out) const
+    // remove the value by the handle without searching the tree.
+    bool remove_handle(const std::size_t handle)
     {
-        if(this->root_ == nil){return;}
-        return query_impl(this->root_, q, out);
+        const boost::optional<leaf_entry_type> found = this->find_handle(handle);
+        if(found)
+        {
+            this->remove_entry(*found);
+            return true;
+        }
+        return false;
     }
 
-    std::ostream& dump(std::ostream& os) const
+    // insert the values in the order along hilbert curve, so that the
+    // consecutive insertions go to nearby leaves. the values are put into the
+    // leaves first, and the boxes of the nodes are recalculated at once.
+    template<typename InputIterator>
+    void insert(InputIterator first, InputIterator last)
     {
-        if(this->empty()){return os;}
-
-        std::vector<std::string> colors; colors.reserve(3);
-        colors.push_back("red");
-        colors.push_back("green");
-        colors.push_back("blue");
-        return dump_node(os, this->root_, 0, colors);
+        std::vector<std::size_t> idxs;
+        for(; first != last; ++first)
+        {
+            idxs.push_back(this->add_value(*first));
+        }
+        return this->insert_values(idxs);
     }
 
-  private:
-
-    std::ostream& dump_node(std::ostream& os,
-              const std::size_t N, const std::size_t depth,
-              const std::vector<std::string>& clrs) const
+    // remove all the values in the range from the leaves first, then condense
+    // the tree at once. the entries of the underfull nodes are reinserted
+    // after that. returns the number of removed values.
+    // in lazy removal mode, the values are marked as dead, and only the leaves
+    // that have too many dead values are purged and condensed at the end.
+    template<typename InputIterator>
+    std::size_t remove(InputIterator first, InputIterator last)
     {
-        const std::string& clr = clrs.at(depth % 3);
-        const node_type& node = tree_.at(N);
-        to_svg(os, node.box, this->boundary_, clr, 1, "none");
-        os << '\n';
-        if(node.is_leaf)
+        std::size_t num_removed = 0;
+        std::vector<std::size_t> dirty;
+        for(; first != last && this->root_ != nil; ++first)
         {
-            for(typename node_type::const_iterator
-                    i(node.entry.cbegin()), e(node.entry.cend()); i!=e; ++i)
+            const boost::optional<leaf_entry_type> found =
+                this->find_leaf(this->root_, *first);
+            if(!found) {continue;}
+
+            ++num_removed;
+            const std::size_t L    = found->first;
+            const std::size_t vidx = *(found->second);
+            if(this->lazy_removal_)
             {
-                to_svg(os, indexable_getter_(this->container_.at(*i)),
-                       this->boundary_, "black", 1, "black");
-                os << '\n';
+                // a leaf is marked dirty only once, when it exceeds max_dead_.
+                if(this->mark_dead(L, vidx) &&
+                   tree_.at(L).dead == this->max_dead_ + 1)
+                {
+                    dirty.push_back(L);
+                }
+                continue;
             }
-            return os;
+            this->tree_.at(L).entry.erase(found->second);
+            this->erase_value(vidx);
+            dirty.push_back(L);
         }
-        else // internal node
+        if(this->lazy_removal_)
         {
-            for(typename node_type::const_iterator
-                    i(node.entry.cbegin()), e(node.entry.cend()); i!=e; ++i)
+            for(std::vector<std::size_t>::const_iterator
+                    i(dirty.begin()), e(dirty.end()); i != e; ++i)
             {
-                this->dump_node(os, *i, depth+1, clrs);
+                this->purge_leaf(*i);
             }
-            return os;
         }
+        if(!dirty.empty())
+        {
+            this->condense_batch(dirty);
+        }
+        return num_removed;
     }
 
-    std::size_t choose_leaf(const indexable_type& entry)
+    // replace old_value by new_value. if new_value still fits in the leaf that
+    // contains old_value, it is overwritten in place and only the boxes are
+    // tightened. otherwise, it is moved to a leaf under the nearest ancestor
+    // that contains it. returns false if old_value is not found.
+    bool update(const value_type& old_value, const value_type& new_value)
     {
         if(this->root_ == nil)
         {
-            node_type n(true, nil);
-            n.box = make_aabb(entry);
-            this->root_ = this->add_node(n);
-
-            return this->root_;
+            return false;
         }
-
-        // choose a leaf to insert
-        // so if root is a leaf, return it
-        std::size_t node_idx = this->root_;
-        while(!(this->tree_.at(node_idx).is_leaf))
+        const boost::optional<leaf_entry_type> found =
+            this->find_leaf(this->root_, old_value);
+        if(!found)
+        {
+            return false;
+        }
+        this->update_entry(*found, new_value);
+        return true;
+    }
+    // update the value by the handle without searching the tree.
+    bool update_handle(const std::size_t handle, const value_type& new_value)
+    {
+        const boost::optional<leaf_entry_type> found = this->find_handle(handle);
+        if(!found)
         {
-            // find minimum expansion
-            scalar_type diff_area_min = std::numeric_limits<scalar_type>::max();
-            scalar_type area_min      = std::numeric_limits<scalar_type>::max();
+            return false;
+        }
+        this->update_entry(*found, new_value);
+        return true;
+    }
 
-            const node_type& node = this->tree_.at(node_idx);
-            for(typename node_type::const_iterator
-                    i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
-            {
-                const scalar_type area_initial
-                    = area(this->tree_.at(*i).box, this->boundary_);
+    template<typename Query, typename OutputIterator>
+    void query(Query q, OutputIterator out) const
+    {
+        if(this->root_ == nil){return;}
+        output_visitor<OutputIterator> visitor(out);
+        this->query_impl(this->root_, this->kernel_form(q), visitor);
+        return;
+    }
 
-                const scalar_type area_expanded
-                    = area(expand(this->tree_.at(*i).box, entry, this->boundary_),
-                           this->boundary_);
+    // run all the queries in the range at once. the queries are sorted along
+    // hilbert curve and the tree is traversed once for each group of nearby
+    // queries, with a bit mask of the queries that are still active in the
+    // node. Query should have box().
+    template<typename QueryIterator>
+    void query_batch(QueryIterator first, QueryIterator last,
+                     query::batch_result& out) const
+    {
+        typedef typename std::iterator_traits<QueryIterator>::value_type
+                query_type;
+        const std::vector<query_type> queries(first, last);
 
-                const scalar_type diff_area = area_expanded - area_initial;
-                if((diff_area <  diff_area_min) ||
-                   (diff_area == diff_area_min  && area_expanded < area_min))
-                {
-                    node_idx = *i;
-                    diff_area_min = diff_area;
-                    area_min      = std::min(area_min, area_expanded);
-                }
+        std::vector<batch_hits_type> hits(1);
+        if(this->root_ != nil && !queries.empty())
+        {
+            packing_buffer_type order;
+            this->sort_queries(queries, order);
+
+            std::vector<std::pair<typename detail::kernel_query_of<
+                node_type, query_type>::type, std::size_t> > group;
+            const std::size_t num_groups =
+                (queries.size() + batch_group_size - 1) / batch_group_size;
+            for(std::size_t g=0; g<num_groups; ++g)
+            {
+                this->query_batch_group(queries, order, g, group, hits.front());
             }
         }
-        return node_idx;
+        return this->gather_hits(hits, queries.size(), out);
     }
 
-    void adjust_tree(std::size_t node_idx)
+#if __cplusplus >= 201103L
+    // the same as query_batch, but the groups of queries are distributed to
+    // the threads in the pool. the result does not depend on the number of
+    // threads or the scheduling. concurrent const member functions never
+    // modify the tree, so it is safe as long as no one modifies the tree.
+    template<typename QueryIterator>
+    void parallel_query_batch(QueryIterator first, QueryIterator last,
+                              query::batch_result& out, thread_pool& pool) const
     {
-        while(tree_.at(node_idx).parent != nil)
+        typedef typename std::iterator_traits<QueryIterator>::value_type
+                query_type;
+        const std::vector<query_type> queries(first, last);
+
+        // per-thread buffers
+        std::vector<batch_hits_type> hits(pool.size());
+        if(this->root_ != nil && !queries.empty())
         {
-            const node_type& node = tree_.at(node_idx);
-            node_type& parent_ = tree_.at(node.parent);
-            parent_.box = expand(parent_.box, node.box, this->boundary_);
-            node_idx = node.parent;
+            packing_buffer_type order;
+            this->sort_queries(queries, order);
+
+            std::vector<std::vector<std::pair<typename detail::kernel_query_of<
+                node_type, query_type>::type, std::size_t> > > groups(pool.size());
+            const std::size_t num_groups =
+                (queries.size() + batch_group_size - 1) / batch_group_size;
+            pool.run(num_groups,
+                [&](const std::size_t g, const std::size_t worker) {
+                    this->query_batch_group(queries, order, g,
+                                            groups[worker], hits[worker]);
+                });
         }
-        return;
+        return this->gather_hits(hits, queries.size(), out);
     }
-    void adjust_tree(const std::size_t N, const std::size_t NN)
+
+    template<typename QueryIterator>
+    void parallel_query_batch(QueryIterator first, QueryIterator last,
+                              query::batch_result& out,
+                              const std::size_t threads) const
     {
-        if(tree_.at(N).parent == nil) // grow tree taller
-        {
-            node_type new_root(false, nil);
-            new_root.entry.push_back(N);
-            new_root.entry.push_back(NN);
-            new_root.box = expand(tree_.at(N).box, tree_.at(NN).box, this->boundary_);
-            this->root_ = this->add_node(new_root);
+        thread_pool pool(threads);
+        return this->parallel_query_batch(first, last, out, pool);
+    }
+#endif
 
-            this->tree_.at(N).parent = this->root_;
-            this->tree_.at(NN).parent = this->root_;
-            return;
-        }
-        else
-        {
-            const node_type& node    = tree_.at(N);
-            const node_type& partner = tree_.at(NN);
-            assert(node.parent == partner.parent);
+    // whether any value matches the query. it returns at the first match.
+    template<typename Query>
+    bool exists(const Query& q) const
+    {
+        if(this->root_ == nil){return false;}
+        return this->exists_impl(this->root_, this->kernel_form(q));
+    }
 
-            node_type& parent_ = tree_.at(node.parent);
-            parent_.box = expand(parent_.box, node.box, this->boundary_); // for N
+    // the number of values that match the query.
+    template<typename Query>
+    std::size_t count(const Query& q) const
+    {
+        if(this->root_ == nil){return 0;}
+        return this->count_impl(this->root_, this->kernel_form(q));
+    }
 
-            if(parent_.has_enough_storage())
-            {
-                parent_.box = expand(parent_.box, partner.box, this->boundary_); // for NN
-                parent_.entry.push_back(NN);
-                return this->adjust_tree(node.parent);
-            }
-            else
+    // call visitor(value, index) for each value that matches the query. the
+    // index can be passed to at(). the visitor returns false to stop the
+    // traversal. it returns false if the visitor has stopped it.
+    template<typename Query, typename Visitor>
+    bool query_visit(const Query& q, Visitor visitor) const
+    {
+        if(this->root_ == nil){return true;}
+        return this->query_impl(this->root_, this->kernel_form(q), visitor);
+    }
+
+    // the end of the incremental query. it compares equal to any
+    // const_query_iterator that has visited all the matching values.
+    struct end_query_iterator {};
+
+    // incremental query. it visits the tree by its own stack of nodes and
+    // stops at each value that matches the query, so the traversal can be
+    // abandoned at any point without touching the rest of the tree.
+    // modifying the tree invalidates the iterator. it is an input iterator;
+    // the copies share the position only until one of them is incremented.
+    template<typename Query>
+    class const_query_iterator
+    {
+      public:
+        typedef std::input_iterator_tag   iterator_category;
+        typedef rtree::value_type         value_type;
+        typedef value_type const&         reference;
+        typedef value_type const*         pointer;
+        typedef std::ptrdiff_t            difference_type;
+
+      private:
+        // {node index, the entries not visited yet that match the query}
+        typedef std::pair<std::size_t, entry_mask_type> frame_type;
+        typedef typename gen_small_vector<frame_type, 16>::type stack_type;
+
+      public:
+
+        // end iterator
+        explicit const_query_iterator(const Query& q)
+            : tree_(0), query_(q), current_(nil)
+        {}
+
+        const_query_iterator(const rtree& t, const Query& q)
+            : tree_(&t), query_(t.kernel_form(q)), current_(nil)
+        {
+            if(t.root_ != nil)
             {
-                const std::size_t PP = this->split_node(node.parent, NN);
-                return this->adjust_tree(node.parent, PP);
+                this->push(t.root_);
+                this->advance();
             }
         }
-    }
 
-    boost::optional<std::pair<std::size_t, typename node_type::const_iterator> >
-    find_leaf(std::size_t node_idx, const value_type& entry) const
-    {
-        const node_type& node = tree_.at(node_idx);
-        if(within(indexable_getter_(entry), node.box, this->boundary_) == false)
+        reference operator*()  const {return tree_->container_.at(current_);}
+        pointer   operator->() const {return &(tree_->container_.at(current_));}
+
+        const_query_iterator& operator++()
         {
-            return boost::none;
+            this->advance();
+            return *this;
+        }
+        const_query_iterator operator++(int)
+        {
+            const_query_iterator tmp(*this);
+            this->advance();
+            return tmp;
         }
 
-        if(node.is_leaf)
+        bool is_end() const BOOST_NOEXCEPT_OR_NOTHROW {return current_ == nil;}
+
+        friend bool operator==(const const_query_iterator& lhs,
+                               const const_query_iterator& rhs)
         {
-            for(typename node_type::const_iterator
-                    i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
-            {
-                if(equal_to_(container_.at(*i), entry))
-                {
-                    return std::make_pair(node_idx, i);
-                }
-            }
-            return boost::none;
+            return lhs.current_ == rhs.current_;
         }
-        else
+        friend bool operator!=(const const_query_iterator& lhs,
+                               const const_query_iterator& rhs)
         {
-            for(typename node_type::const_iterator
-                    i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+            return lhs.current_ != rhs.current_;
+        }
+        friend bool operator==(const const_query_iterator& lhs, end_query_iterator)
+        {
+            return lhs.is_end();
+        }
+        friend bool operator!=(const const_query_iterator& lhs, end_query_iterator)
+        {
+            return !lhs.is_end();
+        }
+        friend bool operator==(end_query_iterator, const const_query_iterator& rhs)
+        {
+            return rhs.is_end();
+        }
+        friend bool operator!=(end_query_iterator, const const_query_iterator& rhs)
+        {
+            return !rhs.is_end();
+        }
+
+      private:
+
+        // go to the next value that matches the query
+        void advance()
+        {
+            while(!this->stack_.empty())
             {
-                if(!within(indexable_getter_(entry), tree_.at(*i).box, this->boundary_))
+                frame_type& top = this->stack_.back();
+                if(top.second == 0)
                 {
+                    this->stack_.pop_back();
                     continue;
                 }
-
+                const node_type& node = tree_->tree_.at(top.first);
+                const std::size_t idx = node.entry[detail::lowest_bit(top.second)];
+                top.second &= (top.second - 1);
+                if(node.is_leaf)
+                {
+                    this->current_ = idx;
+                    return;
+                }
+                this->push(idx);
+            }
+            this->current_ = nil;
+            return;
+        }
+
+        void push(const std::size_t node_idx)
+        {
+            this->stack_.push_back(frame_type(node_idx,
+                tree_->match_entries(query_, tree_->tree_.at(node_idx))));
+            return;
+        }
+
+      private:
+        typedef typename detail::kernel_query_of<node_type, Query>::type
+                kernel_query_type;
+
+        rtree const*      tree_;
+        kernel_query_type query_;
+        stack_type   stack_;
+        std::size_t  current_; // index of the value. nil if it reaches the end
+    };
+
+    template<typename Query>
+    const_query_iterator<Query> qbegin(const Query& q) const
+    {
+        return const_query_iterator<Query>(*this, q);
+    }
+    end_query_iterator qend() const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return end_query_iterator();
+    }
+    // the end iterator of the same type as qbegin(q), e.g. for <algorithm>.
+    template<typename Query>
+    const_query_iterator<Query> qend(const Query& q) const
+    {
+        return const_query_iterator<Query>(q);
+    }
+
+    // best-first search of the k nearest values. it writes
+    // std::pair<value_type, scalar_type> in the order of increasing distance.
+    template<typename OutputIterator>
+    void query(const query::query_nearest<point_type>& q, OutputIterator out) const
+    {
+        if(this->root_ == nil || q.k == 0){return;}
+
+        // {squared distance, index}
+        typedef std::pair<scalar_type, std::size_t> candidate_type;
+        typedef std::vector<candidate_type>         candidate_buffer_type;
+
+        // nodes to be visited, the nearest one comes first.
+        std::priority_queue<candidate_type, candidate_buffer_type,
+                            std::greater<candidate_type> > nodes;
+        // values found so far, the farthest one comes first.
+        std::priority_queue<candidate_type, candidate_buffer_type> found;
+
+        nodes.push(candidate_type(distance_sq(
+                        q.point, tree_.at(this->root_).box, this->boundary_),
+                    this->root_));
+        while(!nodes.empty())
+        {
+            const candidate_type top = nodes.top();
+            nodes.pop();
+            if(found.size() == q.k && found.top().first < top.first)
+            {
+                break; // all the remaining nodes are farther than them
+            }
+
+            const node_type& node = tree_.at(top.second);
+            for(typename node_type::const_iterator
+                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+            {
+                if(node.is_leaf)
+                {
+                    if(this->is_dead(*i)) {continue;}
+                    const scalar_type dist = distance_sq(q.point,
+                        indexable_getter_(container_.at(*i)), this->boundary_);
+                    if(found.size() < q.k)
+                    {
+                        found.push(candidate_type(dist, *i));
+                    }
+                    else if(dist < found.top().first)
+                    {
+                        found.pop();
+                        found.push(candidate_type(dist, *i));
+                    }
+                }
+                else
+                {
+                    const scalar_type dist = distance_sq(
+                            q.point, tree_.at(*i).box, this->boundary_);
+                    if(found.size() < q.k || dist <= found.top().first)
+                    {
+                        nodes.push(candidate_type(dist, *i));
+                    }
+                }
+            }
+        }
+
+        candidate_buffer_type result(found.size());
+        for(typename candidate_buffer_type::reverse_iterator
+                i(result.rbegin()), e(result.rend()); i != e; ++i)
+        {
+            *i = found.top();
+            found.pop();
+        }
+        for(typename candidate_buffer_type::const_iterator
+                i(result.begin()), e(result.end()); i != e; ++i)
+        {
+            *out = std::make_pair(container_.at(i->second), std::sqrt(i->first));
+            ++out;
+        }
+        return;
+    }
+
+    // call f(v1, v2, dr) for each unordered pair of values whose centers are
+    // within the cutoff. dr is the minimum image of (center of v2) - (center
+    // of v1). the tree is traversed against itself at once, so node pairs
+    // that are far apart are pruned together. cutoff should be less than the
+    // half of the cell width.
+    template<typename Function>
+    Function for_each_pair_within(const scalar_type cutoff, Function f) const
+    {
+        return this->for_each_pair_within(cutoff, detail::zero_radius<scalar_type>(), f);
+    }
+
+    // the same as above, but the pair is reported if the distance is within
+    // radius(v1) + radius(v2) + cutoff.
+    template<typename RadiusGetter, typename Function>
+    Function for_each_pair_within(const scalar_type cutoff,
+                                  RadiusGetter radius, Function f) const
+    {
+        if(this->root_ == nil){return f;}
+
+        // the freed and the dead slots do not take part in the join
+        scalar_type max_radius(0);
+        for(std::size_t i=0; i<container_.size(); ++i)
+        {
+            if(!this->contains(i)) {continue;}
+            max_radius = std::max<scalar_type>(max_radius, radius(container_[i]));
+        }
+        const scalar_type threshold = cutoff + max_radius * 2;
+        this->self_join(this->root_, cutoff, threshold * threshold, radius, f);
+        return f;
+    }
+
+    // check the structure of the tree. it is for debugging and testing.
+    bool is_valid() const
+    {
+        if(this->root_ == nil)
+        {
+            return true;
+        }
+        if(tree_.at(this->root_).parent != nil)
+        {
+            return false;
+        }
+        std::size_t leaf_depth = nil;
+        std::size_t num_values = 0;
+        return this->is_valid_node(this->root_, 0, leaf_depth, num_values) &&
+               num_values + overwritable_values_.size() == container_.size();
+    }
+
+    std::ostream& dump(std::ostream& os) const
+    {
+        if(this->root_ == nil){return os;}
+
+        std::vector<std::string> colors; colors.reserve(3);
+        colors.push_back("red");
+        colors.push_back("green");
+        colors.push_back("blue");
+        return dump_node(os, this->root_, 0, colors);
+    }
+
+  private:
+
+    typedef std::vector<std::pair<point_type, std::size_t> > packing_buffer_type;
+
+    point_type center_of(const aabb_type& box) const
+    {
+        return restrict_position(box.center, this->boundary_);
+    }
+
+    // clear the tree and store the values. returns false if the range is empty.
+    template<typename InputIterator>
+    bool prepare_packing(InputIterator first, InputIterator last,
+                         packing_buffer_type& entries)
+    {
+        this->clear();
+        this->container_.assign(first, last);
+        if(this->container_.empty())
+        {
+            return false;
+        }
+        const std::size_t num_values = this->container_.size();
+        if(num_values >= nil)
+        {
+            this->clear();
+            check_index_range(num_values);
+        }
+
+        entries.reserve(this->container_.size());
+        for(std::size_t i=0; i<this->container_.size(); ++i)
+        {
+            entries.push_back(std::make_pair(this->center_of(
+                make_aabb(indexable_getter_(this->container_[i]))), i));
+        }
+        return true;
+    }
+
+    // the nodes of each level are formed by the consecutive nodes in the lower
+    // level, so the whole tree follows the order of the curve.
+    template<typename InputIterator, typename Curve>
+    void assign_along_curve(InputIterator first, InputIterator last,
+                            const Curve curve)
+    {
+        packing_buffer_type entries;
+        if(!this->prepare_packing(first, last, entries))
+        {
+            return;
+        }
+        detail::sort_along_curve(entries.begin(), entries.end(),
+                                 this->boundary_, curve);
+
+        std::vector<std::size_t> ends;
+        detail::chunk_partition<max_entry>(entries.size(), ends);
+        this->build_leaves(entries, ends);
+
+        while(entries.size() > 1)
+        {
+            ends.clear();
+            detail::chunk_partition<max_entry>(entries.size(), ends);
+            this->build_nodes(entries, ends);
+        }
+        this->root_ = entries.front().second;
+        return;
+    }
+
+    // build the nodes by STR until the root is made.
+    void build_upper_levels(packing_buffer_type& entries)
+    {
+        std::vector<std::size_t> ends;
+        while(entries.size() > 1)
+        {
+            ends.clear();
+            detail::str_partition<max_entry>(entries.begin(), entries.end(),
+                    entries.begin(), 0, this->boundary_, ends);
+            this->build_nodes(entries, ends);
+        }
+        this->root_ = entries.front().second;
+        return;
+    }
+
+#if __cplusplus >= 201103L
+    // the entries are sorted along the first axis in parallel and the slabs
+    // are divided into chunks. each thread builds the subtrees of a chunk up to
+    // the level that all the chunks can reach with enough entries, writing the
+    // nodes into the range of tree_ reserved for the chunk. after that, the
+    // subtrees are stitched under a common root by the serial STR.
+    void assign_str_parallel(packing_buffer_type& entries,
+                             const std::size_t threads)
+    {
+        const detail::str_cut<max_entry> cut(entries.size(), 0, dimension);
+        const std::size_t n_slabs  = cut.slabs;
+        const std::size_t n_chunks = std::min(threads, n_slabs);
+
+        detail::parallel_sort(entries.begin(), entries.end(),
+                detail::center_less<point_type>(0), threads);
+        detail::cut_at_widest_gap(entries.begin(), entries.end(), 0,
+                                  this->boundary_);
+
+        // the shape of the subtrees depends only on the number of entries,
+        // so the number of nodes in each level can be counted in advance.
+        std::vector<std::vector<std::size_t> > counts(n_chunks);
+        for(std::size_t t=0; t<n_chunks; ++t)
+        {
+            std::size_t leaves = 0;
+            for(std::size_t i = n_slabs * t / n_chunks,
+                    e = n_slabs * (t+1) / n_chunks; i < e; ++i)
+            {
+                leaves += detail::str_tile_count<max_entry, dimension>(
+                        cut.slab_last(i) - cut.slab_first(i), cut.next_axis);
+            }
+            counts[t].push_back(leaves);
+        }
+        while(true)
+        {
+            bool enough = true;
+            for(std::size_t t=0; t<n_chunks; ++t)
+            {
+                enough = enough && counts[t].back() > max_entry;
+            }
+            if(!enough) {break;}
+
+            for(std::size_t t=0; t<n_chunks; ++t)
+            {
+                counts[t].push_back(detail::str_tile_count<max_entry, dimension>(
+                            counts[t].back(), 0));
+            }
+        }
+
+        std::vector<std::size_t> offsets(n_chunks + 1, 0);
+        for(std::size_t t=0; t<n_chunks; ++t)
+        {
+            offsets[t+1] = offsets[t] + std::accumulate(
+                    counts[t].begin(), counts[t].end(), std::size_t(0));
+        }
+        check_index_range(offsets.back());
+        this->tree_.resize(offsets.back(), node_type(true, nil));
+
+        std::vector<packing_buffer_type> tops(n_chunks);
+        std::vector<std::exception_ptr>  errors(n_chunks);
+        std::vector<std::thread>         workers;
+        for(std::size_t t=0; t<n_chunks; ++t)
+        {
+            workers.emplace_back([&, t]{
+                try
+                {
+                    this->build_str_chunk(entries, cut, n_slabs * t / n_chunks,
+                        n_slabs * (t+1) / n_chunks, offsets[t], offsets[t+1],
+                        counts[t].size(), tops[t]);
+                }
+                catch(...)
+                {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        for(auto& w : workers) {w.join();}
+        for(auto const& err : errors)
+        {
+            if(err)
+            {
+                this->clear();
+                std::rethrow_exception(err);
+            }
+        }
+        this->reorder_values(entries);
+
+        entries.clear();
+        for(auto const& top : tops)
+        {
+            entries.insert(entries.end(), top.begin(), top.end());
+        }
+        return this->build_upper_levels(entries);
+    }
+
+    // build the subtree from the slabs [slab_first, slab_last) of the cut. the
+    // nodes are written into tree_[node_idx, node_last), the range reserved for
+    // the chunk. top is the roots of the subtree.
+    void build_str_chunk(packing_buffer_type& entries,
+            const detail::str_cut<max_entry>& cut,
+            const std::size_t slab_first, const std::size_t slab_last,
+            std::size_t node_idx, const std::size_t node_last,
+            const std::size_t levels, packing_buffer_type& top)
+    {
+        std::vector<std::size_t> ends;
+        for(std::size_t i=slab_first; i<slab_last; ++i)
+        {
+            detail::str_partition<max_entry>(entries.begin() + cut.slab_first(i),
+                    entries.begin() + cut.slab_last(i), entries.begin(),
+                    cut.next_axis, this->boundary_, ends);
+        }
+
+        std::size_t first = cut.slab_first(slab_first);
+        for(std::vector<std::size_t>::const_iterator
+                i(ends.begin()), e(ends.end()); i != e; ++i)
+        {
+            check_chunk_range(node_idx, node_last);
+            this->tree_[node_idx] = this->make_leaf(entries, first, *i);
+            top.push_back(std::make_pair(
+                    this->center_of(tree_[node_idx].box), node_idx));
+            ++node_idx;
+            first = *i;
+        }
+
+        packing_buffer_type parents;
+        for(std::size_t level=1; level<levels; ++level)
+        {
+            ends.clear();
+            detail::str_partition<max_entry>(top.begin(), top.end(),
+                    top.begin(), 0, this->boundary_, ends);
+
+            parents.clear();
+            first = 0;
+            for(std::vector<std::size_t>::const_iterator
+                    i(ends.begin()), e(ends.end()); i != e; ++i)
+            {
+                check_chunk_range(node_idx, node_last);
+                this->tree_[node_idx] = this->make_node(top, first, *i);
+                this->link_children(node_idx);
+                parents.push_back(std::make_pair(
+                        this->center_of(tree_[node_idx].box), node_idx));
+                ++node_idx;
+                first = *i;
+            }
+            top.swap(parents);
+        }
+        if(node_idx != node_last)
+        {
+            throw std::logic_error("perior::rtree: parallel STR chunk does "
+                                   "not fill the nodes reserved for it");
+        }
+        return;
+    }
+
+    // the nodes of a chunk are counted in advance. writing beyond them would
+    // overwrite the nodes of another chunk.
+    static void check_chunk_range(const std::size_t node_idx,
+                                  const std::size_t node_last)
+    {
+        if(node_idx >= node_last)
+        {
+            throw std::logic_error("perior::rtree: parallel STR chunk "
+                                   "overflows the nodes reserved for it");
+        }
+        return;
+    }
+#endif // cpp11
+
+    // make a leaf from the values entries[first, last). the values will be
+    // placed at [first, last) in container_ by reorder_values.
+    node_type make_leaf(const packing_buffer_type& entries,
+                        const std::size_t first, const std::size_t last) const
+    {
+        node_type node(true, nil);
+        aabb_type box = this->fatten(this->container_[entries[first].second]);
+        for(std::size_t j=first; j < last; ++j)
+        {
+            const aabb_type value_box =
+                this->fatten(this->container_[entries[j].second]);
+            node.set_entry_box(node.entry.size(), value_box);
+            node.entry.push_back(j);
+            box = expand(box, value_box, this->boundary_);
+        }
+        node.box = box;
+        return node;
+    }
+
+    // make a node that has the nodes entries[first, last) as its children.
+    node_type make_node(const packing_buffer_type& entries,
+                        const std::size_t first, const std::size_t last) const
+    {
+        node_type node(false, nil, tree_[entries[first].second].level + 1);
+        aabb_type box = tree_[entries[first].second].box;
+        for(std::size_t j=first; j < last; ++j)
+        {
+            node.set_entry_box(node.entry.size(), tree_[entries[j].second].box);
+            node.entry.push_back(entries[j].second);
+            box = expand(box, tree_[entries[j].second].box, this->boundary_);
+        }
+        node.box = box;
+        return node;
+    }
+
+    // update the back-map from the values to the leaf N and the number of
+    // the dead values in it.
+    void link_values(const std::size_t N)
+    {
+        node_type& node = tree_[N];
+        node.dead = 0;
+        for(typename node_type::const_iterator
+                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+        {
+            leaf_of_[*i] = N;
+            if(this->is_dead(*i)) {++node.dead;}
+        }
+        return;
+    }
+
+    void link_children(const std::size_t N)
+    {
+        const node_type& node = tree_[N];
+        for(typename node_type::const_iterator
+                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+        {
+            tree_[*i].parent = N;
+        }
+        return;
+    }
+
+    // sort container_ in the order of the entries.
+    void reorder_values(const packing_buffer_type& entries)
+    {
+        container_type packed;
+        packed.reserve(this->container_.size());
+        for(typename packing_buffer_type::const_iterator
+                i(entries.begin()), e(entries.end()); i != e; ++i)
+        {
+            packed.push_back(this->container_[i->second]);
+        }
+        this->container_.swap(packed);
+
+        // all the leaves have been made here
+        this->leaf_of_.assign(this->container_.size(),
+                              static_cast<std::size_t>(nil));
+        this->dead_.assign(this->container_.size(), false);
+        for(std::size_t i=0; i<this->tree_.size(); ++i)
+        {
+            if(this->tree_[i].is_leaf) {this->link_values(i);}
+        }
+        if(this->skin_ > 0)
+        {
+            this->fat_boxes_.clear();
+            for(typename container_type::const_iterator
+                    i(container_.begin()), e(container_.end()); i != e; ++i)
+            {
+                this->fat_boxes_.push_back(this->fatten(*i));
+            }
+        }
+        return;
+    }
+
+    // make a leaf for each tile and sort container_ in the order of leaves.
+    // after this, entries contain the centers of the leaves.
+    void build_leaves(packing_buffer_type& entries,
+                      const std::vector<std::size_t>& ends)
+    {
+        this->tree_.reserve(ends.size() * (max_entry + 1) / max_entry + 1);
+        packing_buffer_type leaves;
+        leaves.reserve(ends.size());
+
+        std::size_t first = 0;
+        for(std::vector<std::size_t>::const_iterator
+                i(ends.begin()), e(ends.end()); i != e; ++i)
+        {
+            const std::size_t idx =
+                this->add_node(this->make_leaf(entries, first, *i));
+            leaves.push_back(std::make_pair(this->center_of(tree_[idx].box), idx));
+            first = *i;
+        }
+        this->reorder_values(entries);
+        entries.swap(leaves);
+        return;
+    }
+
+    // make a parent node for each tile. entries contain the centers of the
+    // nodes before and of their parents after this.
+    void build_nodes(packing_buffer_type& entries,
+                     const std::vector<std::size_t>& ends)
+    {
+        packing_buffer_type parents;
+        parents.reserve(ends.size());
+
+        std::size_t first = 0;
+        for(std::vector<std::size_t>::const_iterator
+                i(ends.begin()), e(ends.end()); i != e; ++i)
+        {
+            const std::size_t idx =
+                this->add_node(this->make_node(entries, first, *i));
+            this->link_children(idx);
+            parents.push_back(std::make_pair(this->center_of(tree_[idx].box), idx));
+            first = *i;
+        }
+        entries.swap(parents);
+        return;
+    }
+
+    bool is_valid_node(const std::size_t N, const std::size_t depth,
+                       std::size_t& leaf_depth, std::size_t& num_values) const
+    {
+        const node_type& node = tree_.at(N);
+        if(node.entry.size() > max_entry || node.entry.empty() ||
+           (node.parent != nil && !node.has_enough_entry()) ||
+           node.is_leaf != (node.level == 0))
+        {
+            return false;
+        }
+        for(std::size_t k=0; k<node.entry.size(); ++k)
+        {
+            const aabb_type box = node.is_leaf ? this->value_box(node.entry[k]) :
+                                                 tree_.at(node.entry[k]).box;
+            const aabb_type stored = node_type::stored_box(box);
+            if(!(node.entry_box(k) == stored) ||
+               node.entry_volume[k] != static_cast<node_scalar_type>(
+                   area(stored, this->boundary_)))
+            {
+                return false;
+            }
+        }
+        if(node.is_leaf)
+        {
+            if(leaf_depth == nil)
+            {
+                leaf_depth = depth;
+            }
+            num_values += node.entry.size();
+            std::size_t dead = 0;
+            for(typename node_type::const_iterator
+                    i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+            {
+                if(leaf_of_.at(*i) != N) {return false;}
+                if(this->is_dead(*i)) {++dead;}
+            }
+            if(dead != node.dead) {return false;}
+            return leaf_depth == depth;
+        }
+        for(typename node_type::const_iterator
+                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+        {
+            if(tree_.at(*i).parent != N || tree_.at(*i).level + 1 != node.level ||
+               !this->is_valid_node(*i, depth + 1, leaf_depth, num_values))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::ostream& dump_node(std::ostream& os,
+              const std::size_t N, const std::size_t depth,
+              const std::vector<std::string>& clrs) const
+    {
+        const std::string& clr = clrs.at(depth % 3);
+        const node_type& node = tree_.at(N);
+        to_svg(os, node.box, this->boundary_, clr, 1, "none");
+        os << '\n';
+        if(node.is_leaf)
+        {
+            for(typename node_type::const_iterator
+                    i(node.entry.cbegin()), e(node.entry.cend()); i!=e; ++i)
+            {
+                to_svg(os, indexable_getter_(this->container_.at(*i)),
+                       this->boundary_, "black", 1, "black");
+                os << '\n';
+            }
+            return os;
+        }
+        else // internal node
+        {
+            for(typename node_type::const_iterator
+                    i(node.entry.cbegin()), e(node.entry.cend()); i!=e; ++i)
+            {
+                this->dump_node(os, *i, depth+1, clrs);
+            }
+            return os;
+        }
+    }
+
+    // put the value container_[idx] into a leaf under the node `start`. the
+    // box of `start` should contain the value. by default, start from root.
+    void insert_value(const std::size_t idx, const std::size_t start = nil)
+    {
+        if(this->is_dead(idx)) // dead values are erased instead of reinserted
+        {
+            this->dead_[idx] = false;
+            --(this->num_dead_);
+            return this->erase_value(idx);
+        }
+        const aabb_type   entry = this->value_box(idx);
+        const std::size_t L     = this->choose_leaf(entry, start);
+
+        if(tree_.at(L).has_enough_storage())
+        {
+            tree_.at(L).set_entry_box(tree_.at(L).entry.size(), entry);
+            tree_.at(L).entry.push_back(idx);
+            leaf_of_[idx] = L;
+            tree_.at(L).box = expand(tree_.at(L).box, entry, this->boundary_);
+            this->adjust_tree(L);
+        }
+        else if(!this->reinsert_leaf(L, idx, algorithm_tag()))
+        {
+            const std::size_t LL = this->add_node(this->split_leaf(L, idx, entry));
+            this->link_values(L);
+            this->link_values(LL);
+            this->adjust_tree(L, LL);
+        }
+        return;
+    }
+
+    std::size_t choose_leaf(const aabb_type& box, const std::size_t start = nil)
+    {
+        if(this->root_ == nil)
+        {
+            node_type n(true, nil);
+            n.box = box;
+            this->root_ = this->add_node(n);
+
+            return this->root_;
+        }
+
+        // choose a leaf to insert
+        // so if root is a leaf, return it
+        std::size_t node_idx = (start == nil) ? this->root_ : start;
+        while(!(this->tree_.at(node_idx).is_leaf))
+        {
+            node_idx = this->choose_subtree(node_idx, box, algorithm_tag());
+        }
+        return node_idx;
+    }
+
+    template<typename Tag>
+    BOOST_FORCEINLINE
+    std::size_t choose_subtree(const std::size_t N, const aabb_type& entry, Tag) const
+    {
+        return this->choose_by_area(N, entry);
+    }
+
+    // find the child that needs minimum expansion
+    std::size_t choose_by_area(const std::size_t N, const aabb_type& entry) const
+    {
+        scalar_type diff_area_min = std::numeric_limits<scalar_type>::max();
+        scalar_type area_min      = std::numeric_limits<scalar_type>::max();
+
+        std::size_t node_idx = N;
+        const node_type& node = this->tree_.at(N);
+        for(std::size_t k=0; k<node.entry.size(); ++k)
+        {
+            // the volume is cached in node_scalar_type. the expanded one is
+            // rounded in the same way, so a child that already contains the
+            // entry does not need any expansion.
+            const scalar_type area_initial  = node.entry_volume[k];
+            const scalar_type area_expanded = static_cast<node_scalar_type>(
+                expanded_area(node.entry_box(k), entry, this->boundary_));
+
+            const scalar_type diff_area = area_expanded - area_initial;
+            if((diff_area <  diff_area_min) ||
+               (diff_area == diff_area_min  && area_expanded < area_min))
+            {
+                node_idx = node.entry[k];
+                diff_area_min = diff_area;
+                area_min      = std::min(area_min, area_expanded);
+            }
+        }
+        return node_idx;
+    }
+
+    // R*-tree chooses the leaf that needs minimum overlap enlargement.
+    std::size_t choose_subtree(const std::size_t N, const aabb_type& entry,
+                               rstar_tag) const
+    {
+        const node_type& node = this->tree_.at(N);
+        if(node.level != 1) // the children are not leaves
+        {
+            return this->choose_by_area(N, entry);
+        }
+
+        scalar_type diff_overlap_min = std::numeric_limits<scalar_type>::max();
+        scalar_type diff_area_min    = std::numeric_limits<scalar_type>::max();
+        scalar_type area_min         = std::numeric_limits<scalar_type>::max();
+
+        std::size_t node_idx = N;
+        for(std::size_t i=0; i<node.entry.size(); ++i)
+        {
+            const aabb_type box      = node.entry_box(i);
+            const aabb_type expanded = expand(box, entry, this->boundary_);
+
+            scalar_type diff_overlap = 0;
+            for(std::size_t j=0; j<node.entry.size(); ++j)
+            {
+                if(i == j) {continue;}
+                const aabb_type other = node.entry_box(j);
+                diff_overlap += overlap(expanded, other, this->boundary_) -
+                                overlap(box,      other, this->boundary_);
+            }
+            const scalar_type area_initial  = node.entry_volume[i];
+            const scalar_type area_expanded = static_cast<node_scalar_type>(
+                    area(expanded, this->boundary_));
+            const scalar_type diff_area     = area_expanded - area_initial;
+
+            if(diff_overlap < diff_overlap_min ||
+               (diff_overlap == diff_overlap_min &&
+                (diff_area < diff_area_min ||
+                 (diff_area == diff_area_min && area_expanded < area_min))))
+            {
+                node_idx = node.entry[i];
+                diff_overlap_min = diff_overlap;
+                diff_area_min    = diff_area;
+                area_min         = area_expanded;
+            }
+        }
+        return node_idx;
+    }
+
+    // expand the ancestors of the node that has grown. the ancestors of a
+    // parent that already contains the node do not change, so it stops there.
+    void adjust_tree(std::size_t node_idx)
+    {
+        while(tree_.at(node_idx).parent != nil)
+        {
+            const node_type& node = tree_.at(node_idx);
+            node_type& parent_ = tree_.at(node.parent);
+            this->sync_entry(node.parent, node_idx);
+            if(within(node.box, parent_.box, this->boundary_))
+            {
+                break;
+            }
+            parent_.box = expand(parent_.box, node.box, this->boundary_);
+            node_idx = node.parent;
+        }
+        return;
+    }
+    void adjust_tree(const std::size_t N, const std::size_t NN)
+    {
+        if(tree_.at(N).parent == nil) // grow tree taller
+        {
+            node_type new_root(false, nil, tree_.at(N).level + 1);
+            new_root.set_entry_box(0, tree_.at(N).box);
+            new_root.set_entry_box(1, tree_.at(NN).box);
+            new_root.entry.push_back(N);
+            new_root.entry.push_back(NN);
+            new_root.box = expand(tree_.at(N).box, tree_.at(NN).box,
+                                  this->boundary_);
+            this->root_ = this->add_node(new_root);
+
+            this->tree_.at(N).parent = this->root_;
+            this->tree_.at(NN).parent = this->root_;
+            return;
+        }
+        else
+        {
+            const node_type& node    = tree_.at(N);
+            const node_type& partner = tree_.at(NN);
+            assert(node.parent == partner.parent);
+
+            const std::size_t P = node.parent;
+            node_type& parent_ = tree_.at(P);
+            // for N
+            this->sync_entry(P, N);
+            parent_.box = expand(parent_.box, node.box, this->boundary_);
+
+            if(parent_.has_enough_storage())
+            {
+                // for NN
+                parent_.box = expand(parent_.box, partner.box, this->boundary_);
+                parent_.set_entry_box(parent_.entry.size(), partner.box);
+                parent_.entry.push_back(NN);
+                return this->adjust_tree(P);
+            }
+            else if(!this->reinsert_node(P, NN, algorithm_tag()))
+            {
+                const std::size_t PP = this->split_node(P, NN);
+                return this->adjust_tree(P, PP);
+            }
+        }
+        return;
+    }
+
+    // recalculate the boxes of the ancestors of N after N has shrunk.
+    // the boxes of the upper nodes depend only on their children, so it stops
+    // when a box does not change.
+    void tighten_ancestors(std::size_t N)
+    {
+        while(tree_.at(N).parent != nil)
+        {
+            N = tree_.at(N).parent;
+            const aabb_type prev = tree_.at(N).box;
+            this->condense_box(tree_.at(N));
+            if(tree_.at(N).box == prev) {break;}
+        }
+        return;
+    }
+
+    // only R*-tree re-inserts the entries of an overflowing node.
+    template<typename Tag>
+    BOOST_FORCEINLINE
+    bool reinsert_leaf(const std::size_t, const std::size_t, Tag)
+        BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return false;
+    }
+    template<typename Tag>
+    BOOST_FORCEINLINE
+    bool reinsert_node(const std::size_t, const std::size_t, Tag)
+        BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return false;
+    }
+
+    // R*-tree's forced reinsertion. when the leaf L overflows because of the
+    // value vidx for the first time in this insertion, the entries farthest
+    // from the center of L are re-inserted instead of splitting it.
+    bool reinsert_leaf(const std::size_t L, const std::size_t vidx, rstar_tag)
+    {
+        if(parameter_type::reinsert_entry == 0 || tree_.at(L).parent == nil ||
+           (this->reinserted_levels_ & 1u) != 0)
+        {
+            return false;
+        }
+        this->reinserted_levels_ |= 1u;
+
+        split_buffer_type entries, removed;
+        entries.push_back(std::make_pair(vidx, this->value_box(vidx)));
+        const node_type& node = tree_.at(L);
+        for(typename node_type::const_iterator
+                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+        {
+            entries.push_back(std::make_pair(*i, this->value_box(*i)));
+        }
+        detail::pick_reinserted<parameter_type::reinsert_entry>(
+                entries, removed, this->boundary_);
+
+        this->assign_entries(tree_.at(L), entries);
+        this->link_values(L);
+        this->tighten_ancestors(L);
+
+        // close reinsert: starts from the nearest one
+        for(typename split_buffer_type::const_reverse_iterator
+                i(removed.rbegin()), e(removed.rend()); i != e; ++i)
+        {
+            this->insert_value(i->first);
+        }
+        return true;
+    }
+
+    // R*-tree's forced reinsertion for the internal node P that overflows
+    // because of the new child NN.
+    bool reinsert_node(const std::size_t P, const std::size_t NN, rstar_tag)
+    {
+        const std::size_t level = this->level_of(P);
+        if(parameter_type::reinsert_entry == 0 || tree_.at(P).parent == nil ||
+           (this->reinserted_levels_ & (std::size_t(1) << level)) != 0)
+        {
+            return false;
+        }
+        this->reinserted_levels_ |= (std::size_t(1) << level);
+
+        split_buffer_type entries, removed;
+        entries.push_back(std::make_pair(NN, tree_.at(NN).box));
+        const node_type& node = tree_.at(P);
+        for(typename node_type::const_iterator
+                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+        {
+            entries.push_back(std::make_pair(*i, tree_.at(*i).box));
+        }
+        detail::pick_reinserted<parameter_type::reinsert_entry>(
+                entries, removed, this->boundary_);
+
+        this->assign_entries(tree_.at(P), entries);
+        this->link_children(P);
+        this->tighten_ancestors(P);
+
+        for(typename split_buffer_type::const_reverse_iterator
+                i(removed.rbegin()), e(removed.rend()); i != e; ++i)
+        {
+            this->re_insert(i->first);
+        }
+        return true;
+    }
+
+    typedef std::pair<std::size_t, typename node_type::const_iterator>
+            leaf_entry_type;
+
+    // the leaf that contains the value pointed by the handle.
+    boost::optional<leaf_entry_type> find_handle(const std::size_t handle) const
+    {
+        if(!this->contains(handle))
+        {
+            return boost::none;
+        }
+        const std::size_t L = leaf_of_[handle];
+        const node_type& node = tree_.at(L);
+        const typename node_type::const_iterator found =
+            std::find(node.entry.begin(), node.entry.end(), handle);
+        assert(found != node.entry.end());
+        return std::make_pair(L, found);
+    }
+
+    void remove_entry(const leaf_entry_type& found)
+    {
+        const std::size_t node_idx  =   found.first;
+        const std::size_t value_idx = *(found.second);
+        if(this->lazy_removal_)
+        {
+            return this->bury_value(node_idx, value_idx);
+        }
+        this->tree_.at(node_idx).entry.erase(found.second);
+        this->erase_value(value_idx);
+        if(this->tree_.at(node_idx).entry.empty() && node_idx == this->root_)
+        {
+            this->clear();
+            return;
+        }
+        this->reinserted_levels_ = 0;
+        this->condense_tree(node_idx);
+        return;
+    }
+
+    // mark the value in the leaf L as dead. if the leaf has too many dead
+    // values, erase them and condense the tree from the leaf.
+    void bury_value(const std::size_t L, const std::size_t vidx)
+    {
+        if(!this->mark_dead(L, vidx))
+        {
+            return;
+        }
+        this->purge_leaf(L);
+        std::vector<std::size_t> dirty(1, L);
+        return this->condense_batch(dirty);
+    }
+
+    // mark the value in the leaf L as dead. true if the leaf has too many
+    // dead values.
+    bool mark_dead(const std::size_t L, const std::size_t vidx)
+    {
+        this->dead_[vidx] = true;
+        ++(this->num_dead_);
+        return ++(tree_.at(L).dead) > this->max_dead_;
+    }
+
+    // erase the dead values in the leaf L. the box is not updated.
+    void purge_leaf(const std::size_t L)
+    {
+        node_type& leaf = tree_.at(L);
+        typename node_type::iterator last = leaf.entry.begin();
+        for(typename node_type::iterator
+                i(leaf.entry.begin()), e(leaf.entry.end()); i != e; ++i)
+        {
+            if(this->dead_[*i])
+            {
+                this->dead_[*i] = false;
+                --(this->num_dead_);
+                this->erase_value(*i);
+            }
+            else
+            {
+                *last++ = *i;
+            }
+        }
+        leaf.entry.erase(last, leaf.entry.end());
+        leaf.dead = 0;
+        return;
+    }
+
+    // replace the value. if it still fits in the leaf, it is overwritten in
+    // place. otherwise, it is moved under the nearest ancestor that contains it.
+    void update_entry(const leaf_entry_type& found, const value_type& new_value)
+    {
+        const std::size_t L    =   found.first;
+        const std::size_t vidx = *(found.second);
+        this->container_.at(vidx) = new_value;
+
+        if(this->skin_ > 0)
+        {
+            // in fattened AABB mode, the tree does not change while the value
+            // stays inside of its fat box.
+            ++(this->skin_stats_.updates);
+            if(within(indexable_getter_(new_value), fat_boxes_.at(vidx),
+                      this->boundary_))
+            {
+                return;
+            }
+            ++(this->skin_stats_.escapes);
+            fat_boxes_.at(vidx) = this->fatten(new_value);
+        }
+
+        const aabb_type entry = this->value_box(vidx);
+        if(within(entry, tree_.at(L).box, this->boundary_))
+        {
+            this->condense_box(tree_.at(L));
+            this->tighten_ancestors(L);
+            return;
+        }
+
+        this->tree_.at(L).entry.erase(found.second);
+        if(this->tree_.at(L).entry.empty() && L == this->root_)
+        {
+            tree_.at(L).set_entry_box(0, entry);
+            tree_.at(L).entry.push_back(vidx);
+            tree_.at(L).box = entry;
+            return;
+        }
+        this->reinserted_levels_ = 0;
+        if(L != this->root_ && !tree_.at(L).has_enough_entry())
+        {
+            this->condense_tree(L);
+            this->insert_value(vidx);
+            return;
+        }
+        this->condense_box(tree_.at(L));
+        this->tighten_ancestors(L);
+
+        std::size_t A = tree_.at(L).parent;
+        while(A != nil && !within(entry, tree_.at(A).box, this->boundary_))
+        {
+            A = tree_.at(A).parent;
+        }
+        this->insert_value(vidx, A);
+        return;
+    }
+
+    boost::optional<leaf_entry_type>
+    find_leaf(std::size_t node_idx, const value_type& entry) const
+    {
+        const node_type& node = tree_.at(node_idx);
+        if(within(indexable_getter_(entry), node.box, this->boundary_) == false)
+        {
+            return boost::none;
+        }
+
+        if(node.is_leaf)
+        {
+            for(typename node_type::const_iterator
+                    i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+            {
+                if(!this->is_dead(*i) && equal_to_(container_.at(*i), entry))
+                {
+                    return std::make_pair(node_idx, i);
+                }
+            }
+            return boost::none;
+        }
+        else
+        {
+            for(typename node_type::const_iterator
+                    i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+            {
+                if(!within(indexable_getter_(entry), tree_.at(*i).box, this->boundary_))
+                {
+                    continue;
+                }
+
                 boost::optional<
                     std::pair<std::size_t, typename node_type::const_iterator>
                     > found = this->find_leaf(*i, entry);
@@ -331,378 +1912,645 @@ class rtree
         }
     }
 
-    void condense_leaf(const std::size_t N)
+    // Guttman's CondenseTree. N is the leaf that lost an entry. the nodes
+    // that do not have enough entries are removed on the way to the root, and
+    // their entries are re-inserted after that.
+    void condense_tree(std::size_t N)
+    {
+        typedef typename gen_small_vector<std::size_t, max_entry>::type
+                temporal_vec_type;
+        temporal_vec_type eliminated_objs;
+        temporal_vec_type eliminated_nodes;
+
+        while(tree_.at(N).parent != nil)
+        {
+            const std::size_t P = tree_.at(N).parent;
+            node_type& node = tree_.at(N);
+            if(node.has_enough_entry())
+            {
+                this->condense_box(node);
+            }
+            else
+            {
+                temporal_vec_type& eliminated =
+                    node.is_leaf ? eliminated_objs : eliminated_nodes;
+                std::copy(node.entry.begin(), node.entry.end(),
+                          std::back_inserter(eliminated));
+
+                typename node_type::iterator found = std::find(
+                        tree_.at(P).entry.begin(), tree_.at(P).entry.end(), N);
+                assert(found != tree_.at(P).entry.end());
+                tree_.at(P).entry.erase(found);
+                this->erase_node(N);
+            }
+            N = P;
+        }
+
+        assert(N == this->root_);
+        if(!tree_.at(N).entry.empty())
+        {
+            this->condense_box(tree_.at(N));
+        }
+
+        // re-insert nodes eliminated from the tree, then the values. it should
+        // be done before shortening the tree because the eliminated nodes
+        // need a parent at their original level.
+        for(typename temporal_vec_type::const_iterator
+                i(eliminated_nodes.begin()), e(eliminated_nodes.end()); i!=e; ++i)
+        {
+            this->re_insert(*i);
+        }
+        for(typename temporal_vec_type::const_iterator
+                i(eliminated_objs.begin()), e(eliminated_objs.end()); i!=e; ++i)
+        {
+            this->insert_value(*i);
+        }
+
+        return this->shorten_tree();
+    }
+
+    // shorten the tree if the root has only one child
+    void shorten_tree()
+    {
+        while(!tree_.at(this->root_).is_leaf &&
+              tree_.at(this->root_).entry.size() == 1)
+        {
+            const std::size_t old_root = this->root_;
+            this->root_ = tree_.at(old_root).entry.front();
+            tree_.at(this->root_).parent = nil;
+            this->erase_node(old_root);
+        }
+        return;
+    }
+
+    // condense_tree for the leaves from which several values are removed.
+    // the dirty nodes are processed level by level from the leaves, so each
+    // node is condensed once even if many of its descendants have changed.
+    void condense_batch(std::vector<std::size_t>& dirty)
+    {
+        std::vector<std::size_t> eliminated_objs;
+        std::vector<std::size_t> eliminated_nodes;
+        std::vector<std::size_t> parents;
+        while(!dirty.empty())
+        {
+            std::sort(dirty.begin(), dirty.end());
+            dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+            parents.clear();
+            for(std::vector<std::size_t>::const_iterator
+                    i(dirty.begin()), e(dirty.end()); i != e; ++i)
+            {
+                const std::size_t N = *i;
+                const std::size_t P = tree_.at(N).parent;
+                if(P == nil) {continue;} // root
+                parents.push_back(P);
+
+                node_type& node = tree_.at(N);
+                if(node.has_enough_entry())
+                {
+                    this->condense_box(node);
+                    continue;
+                }
+                std::vector<std::size_t>& eliminated =
+                    node.is_leaf ? eliminated_objs : eliminated_nodes;
+                eliminated.insert(eliminated.end(),
+                                  node.entry.begin(), node.entry.end());
+
+                typename node_type::iterator found = std::find(
+                        tree_.at(P).entry.begin(), tree_.at(P).entry.end(), N);
+                assert(found != tree_.at(P).entry.end());
+                tree_.at(P).entry.erase(found);
+                this->erase_node(N);
+            }
+            dirty.swap(parents);
+        }
+
+        if(tree_.at(this->root_).entry.empty())
+        {
+            if(tree_.at(this->root_).is_leaf) // no value remains
+            {
+                assert(eliminated_objs.empty() && eliminated_nodes.empty());
+                return this->clear();
+            }
+            // all the subtrees are eliminated. no node can be reinserted at
+            // its level, so the tree is rebuilt from the values in them.
+            for(std::vector<std::size_t>::const_iterator
+                i(eliminated_nodes.begin()), e(eliminated_nodes.end()); i!=e; ++i)
+            {
+                this->collect_values(*i, eliminated_objs);
+            }
+            if(eliminated_objs.empty())
+            {
+                return this->clear();
+            }
+            eliminated_nodes.clear();
+            this->tree_.clear();
+            this->overwritable_nodes_.clear();
+            this->root_ = nil;
+        }
+        else
+        {
+            this->condense_box(tree_.at(this->root_));
+        }
+
+        this->reinserted_levels_ = 0;
+        for(std::vector<std::size_t>::const_iterator
+                i(eliminated_nodes.begin()), e(eliminated_nodes.end()); i!=e; ++i)
+        {
+            this->re_insert(*i);
+        }
+        this->insert_values(eliminated_objs);
+        return this->shorten_tree();
+    }
+
+    // append the values in the subtree N to out
+    void collect_values(const std::size_t N, std::vector<std::size_t>& out) const
     {
-        const node_type& node = this->tree_.at(N);
-        assert(node.is_leaf);
-
-        if(node.has_enough_entry() || node.parent == nil)
+        const node_type& node = tree_.at(N);
+        if(node.is_leaf)
         {
+            out.insert(out.end(), node.entry.begin(), node.entry.end());
             return;
         }
+        for(typename node_type::const_iterator
+                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+        {
+            this->collect_values(*i, out);
+        }
+        return;
+    }
 
-        // copy index of objects
-        typedef typename gen_small_vector<std::size_t, min_entry>::type temporal_vec_type;
-        temporal_vec_type eliminated_objs;
-        std::copy(node.entry.begin(), node.entry.end(),
-                  std::back_inserter(eliminated_objs));
-
-        // erase the node N from its parent and condense aabb
-        typename node_type::iterator found = std::find(
-                this->tree_.at(node.parent).entry.begin(),
-                this->tree_.at(node.parent).entry.end(), N);
-        assert(found != this->tree_.at(node.parent).entry.end());
-        this->tree_.at(node.parent).entry.erase(found);
-        this->condense_box(this->tree_.at(node.parent));
-
-        // re-insert entries eliminated from node N
-        for(typename temporal_vec_type::const_iterator
-                i(eliminated_objs.begin()), e(eliminated_objs.end()); i!=e; ++i)
+    // insert the values that are already in container_ along hilbert curve.
+    // each value is put into its leaf without touching the ancestors, and the
+    // full leaves are split on the way. the boxes of the ancestors of the
+    // touched leaves are recalculated once at the end, level by level, by
+    // condense_batch. R*-tree's forced reinsertion is not done in a batch.
+    // the consecutive values are close to each other, so the search for a leaf
+    // starts from the lowest node around the previous leaf that contains it.
+    void insert_values(std::vector<std::size_t>& idxs)
+    {
+        packing_buffer_type entries;
+        entries.reserve(idxs.size());
+        for(std::vector<std::size_t>::const_iterator
+                i(idxs.begin()), e(idxs.end()); i != e; ++i)
         {
-            this->insert(this->container_.at(*i));
+            entries.push_back(std::make_pair(
+                        this->center_of(this->value_box(*i)), *i));
         }
+        detail::sort_along_curve(entries.begin(), entries.end(),
+                                 this->boundary_, hilbert_packing());
 
-        // condense ancester nodes...
-        condense_node(node.parent);
+        std::vector<std::size_t> dirty;
+        std::size_t prev = nil;
+        for(typename packing_buffer_type::const_iterator
+                i(entries.begin()), e(entries.end()); i != e; ++i)
+        {
+            const std::size_t idx = i->second;
+            if(this->is_dead(idx)) // dead values are erased instead
+            {
+                this->dead_[idx] = false;
+                --(this->num_dead_);
+                this->erase_value(idx);
+                continue;
+            }
+            const aabb_type   entry = this->value_box(idx);
+            const std::size_t L     = this->choose_leaf(entry,
+                                        this->covering_ancestor(prev, entry));
+            dirty.push_back(L);
+            prev = L;
+
+            node_type& leaf = tree_.at(L);
+            if(leaf.has_enough_storage())
+            {
+                leaf.set_entry_box(leaf.entry.size(), entry);
+                leaf.entry.push_back(idx);
+                leaf_of_[idx] = L;
+                leaf.box = expand(leaf.box, entry, this->boundary_);
+                continue;
+            }
+            const std::size_t LL = this->add_node(this->split_leaf(L, idx, entry));
+            this->link_values(L);
+            this->link_values(LL);
+            this->attach_partner(L, LL);
+            dirty.push_back(LL);
+        }
+        if(!dirty.empty())
+        {
+            this->condense_batch(dirty);
+        }
         return;
     }
 
-    void condense_node(const std::size_t N)
+    // the lowest one of N and its ancestors whose box contains the box.
+    // nil if there is no such node.
+    std::size_t covering_ancestor(std::size_t N, const aabb_type& box) const
     {
-        const node_type& node = this->tree_.at(N);
-        assert(node.is_leaf == false);
+        while(N != nil && !within(box, tree_.at(N).box, this->boundary_))
+        {
+            N = tree_.at(N).parent;
+        }
+        return N;
+    }
 
-        if(node.has_enough_entry())
+    // add the new partner NN of the split node N to the parent of N, splitting
+    // the parent if needed. unlike adjust_tree, it does not update the boxes
+    // of the ancestors. the caller recalculates them after that.
+    void attach_partner(const std::size_t N, const std::size_t NN)
+    {
+        const std::size_t P = tree_.at(N).parent;
+        if(P == nil)
         {
-            return;
+            return this->adjust_tree(N, NN); // grow tree taller
         }
-        if(node.parent == nil && node.entry.size() == 1)
+        node_type& parent_ = tree_.at(P);
+        if(parent_.has_enough_storage())
         {
-            this->root_ = node.entry.front();
-            this->erase_node(N);
+            parent_.set_entry_box(parent_.entry.size(), tree_.at(NN).box);
+            parent_.entry.push_back(NN);
             return;
         }
+        const std::size_t PP = this->split_node(P, NN);
+        return this->attach_partner(P, PP);
+    }
 
-        // collect index of nodes that are children of the node to be removed
-        typedef typename gen_small_vector<std::size_t, min_entry>::type temporal_vec_type;
-        temporal_vec_type eliminated_nodes;
-        std::copy(node.entry.begin(), node.entry.end(),
-                  std::back_inserter(eliminated_nodes));
-
-        // erase the node N from its parent and condense its aabb
-        typename node_type::iterator found = std::find(
-                this->tree_.at(node.parent).entry.begin(),
-                this->tree_.at(node.parent).entry.end(), N);
-        assert(found != this->tree_.at(node.parent).entry.end());
-        this->tree_.at(node.parent).entry.erase(found);
-        this->condense_box(this->tree_.at(node.parent));
-
-        // re-insert nodes eliminated from node N
-        for(typename temporal_vec_type::const_iterator
-                i(eliminated_nodes.begin()), e(eliminated_nodes.end()); i!=e; ++i)
+    typedef typename gen_static_vector<std::pair<std::size_t, aabb_type>,
+            max_entry+1>::type split_buffer_type;
+
+    // set the entries and the box of the node.
+    void assign_entries(node_type& node, const split_buffer_type& entries)
+    {
+        node.entry.clear();
+        for(typename split_buffer_type::const_iterator
+                i(entries.begin()), e(entries.end()); i != e; ++i)
         {
-            this->re_insert(*i);
+            node.set_entry_box(node.entry.size(), i->second);
+            node.entry.push_back(i->first);
         }
-        this->condense_node(node.parent);
+        node.box = detail::bounding_box_of(
+                entries.begin(), entries.end(), this->boundary_);
         return;
     }
 
-    // TODO move it to quadratic struct
     node_type split_leaf(const std::size_t N,
-                         const std::size_t vidx, const indexable_type& entry)
+                         const std::size_t vidx, const aabb_type& entry)
     {
-        node_type& node = tree_.at(N);
-        node_type  partner(true, node.parent);
-
-        typedef typename gen_static_vector<std::pair<std::size_t, indexable_type>,
-                max_entry+1>::type temporal_entry_container;
-        temporal_entry_container entries;
+        split_buffer_type entries, group1, group2;
         entries.push_back(std::make_pair(vidx, entry));
 
+        node_type& node = tree_.at(N);
         for(typename node_type::const_iterator
                 i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
         {
-            entries.push_back(std::make_pair(
-                        *i, indexable_getter_(container_.at(*i))));
+            entries.push_back(std::make_pair(*i, this->value_box(*i)));
         }
-        node.entry.clear();
-        partner.entry.clear(); // for make it sure
+        detail::split_entries<min_entry>(
+                entries, group1, group2, this->boundary_, algorithm_tag());
 
-        /* assign first 2 entries to node and partner */
-        {
-            const boost::array<std::size_t, 2> seeds =
-                this->pick_seeds(entries.begin(), entries.end());
-               node.entry.push_back(entries.at(seeds[0]).first);
-            partner.entry.push_back(entries.at(seeds[1]).first);
+        node_type partner(true, node.parent);
+        this->assign_entries(node,    group1);
+        this->assign_entries(partner, group2);
+        return partner;
+    }
+
+    // split nodes because of new node NN
+    std::size_t split_node(const std::size_t P, const std::size_t NN)
+    {
+        const std::size_t PP = this->add_node(
+                node_type(false, tree_.at(P).parent, tree_.at(P).level));
 
-               node.box = make_aabb(entries.at(seeds[0]).second);
-            partner.box = make_aabb(entries.at(seeds[1]).second);
+        split_buffer_type entries, group1, group2;
+        entries.push_back(std::make_pair(NN, tree_.at(NN).box));
 
-            // remove them from entries pool
-            entries.erase(entries.begin() + std::max(seeds[0], seeds[1]));
-            entries.erase(entries.begin() + std::min(seeds[0], seeds[1]));
+        const node_type& node = tree_.at(P);
+        for(typename node_type::const_iterator
+                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+        {
+            entries.push_back(std::make_pair(*i, tree_.at(*i).box));
         }
+        detail::split_entries<min_entry>(
+                entries, group1, group2, this->boundary_, algorithm_tag());
+
+        this->assign_entries(tree_.at(P),  group1);
+        this->assign_entries(tree_.at(PP), group2);
+        this->link_children(P);
+        this->link_children(PP);
+        return PP;
+    }
 
-        while(!entries.empty())
+    template<typename Query, typename Visitor>
+    bool query_impl(std::size_t node_idx, const Query& q, Visitor& visitor) const
+    {
+        const node_type& node = tree_.at(node_idx);
+        const entry_mask_type mask = this->match_entries(q, node);
+        for(entry_mask_type m = mask; m != 0; m &= (m - 1))
         {
-            if(min_entry > node.entry.size() &&
-               min_entry - node.entry.size() >= entries.size())
+            const std::size_t next = node.entry[detail::lowest_bit(m)];
+            if(node.is_leaf)
             {
-                for(typename temporal_entry_container::const_iterator
-                        i(entries.begin()), e(entries.end()); i != e; ++i)
-                {
-                    node.entry.push_back(i->first);
-                    node.box = expand(node.box, i->second, this->boundary_);
-                }
-                return partner;
+                if(!visitor(container_[next], next)) {return false;}
             }
-            if(min_entry > partner.entry.size() &&
-               min_entry - partner.entry.size() >= entries.size())
+            else if(!this->query_impl(next, q, visitor))
             {
-                for(typename temporal_entry_container::const_iterator
-                        i(entries.begin()), e(entries.end()); i != e; ++i)
-                {
-                    partner.entry.push_back(i->first);
-                    partner.box = expand(partner.box, i->second, this->boundary_);
-                }
-                return partner;
+                return false;
             }
+        }
+        return true;
+    }
+
+    typedef boost::uint64_t batch_mask_type;
+    BOOST_STATIC_CONSTEXPR std::size_t batch_group_size = 64;
+
+    // {query index, value index} in the order of the traversal
+    typedef std::vector<std::pair<std::size_t, std::size_t> > batch_hits_type;
+
+    // order the queries along hilbert curve so that each group is compact.
+    template<typename Query>
+    void sort_queries(const std::vector<Query>& queries,
+                      packing_buffer_type& order) const
+    {
+        order.clear();
+        order.reserve(queries.size());
+        for(std::size_t i=0; i<queries.size(); ++i)
+        {
+            order.push_back(std::make_pair(this->center_of(queries[i].box()), i));
+        }
+        detail::sort_along_curve(order.begin(), order.end(), this->boundary_,
+                                 hilbert_packing());
+        return;
+    }
+
+    // run the g-th group of the sorted queries. group is a buffer.
+    template<typename Query, typename KernelQuery>
+    void query_batch_group(const std::vector<Query>& queries,
+            const packing_buffer_type& order, const std::size_t g,
+            std::vector<std::pair<KernelQuery, std::size_t> >& group,
+            batch_hits_type& hits) const
+    {
+        const std::size_t group_max  = batch_group_size;
+        const std::size_t group_size =
+            std::min(group_max, queries.size() - g * group_max);
+        group.clear();
+        for(std::size_t i=0; i<group_size; ++i)
+        {
+            const std::size_t qidx = order[g * group_max + i].second;
+            group.push_back(std::make_pair(
+                        KernelQuery(this->kernel_form(queries[qidx])), qidx));
+        }
+        const batch_mask_type mask =
+            (group_size == sizeof(batch_mask_type) * CHAR_BIT) ?
+            ~batch_mask_type(0) : (batch_mask_type(1) << group_size) - 1;
+        this->query_batch_impl(this->root_, group, mask, hits);
+        return;
+    }
 
-            const std::pair<std::size_t, bool> next =
-                this->pick_next(entries.begin(), entries.end(), node.box, partner.box);
-            if(next.second) // next is for node
+    // counting sort by the query index. all the hits of a query are in one
+    // buffer in the order of the traversal, so the order is kept.
+    static void gather_hits(const std::vector<batch_hits_type>& hits,
+            const std::size_t num_queries, query::batch_result& out)
+    {
+        out.offsets.assign(num_queries + 1, 0);
+        for(std::size_t b=0; b<hits.size(); ++b)
+        {
+            for(std::size_t i=0; i<hits[b].size(); ++i)
             {
-                node.entry.push_back(entries.at(next.first).first);
-                node.box =
-                    expand(node.box, entries.at(next.first).second, this->boundary_);
+                ++out.offsets[hits[b][i].first + 1];
             }
-            else // next is for partner
+        }
+        std::partial_sum(out.offsets.begin(), out.offsets.end(), out.offsets.begin());
+        std::vector<std::size_t> cursor(out.offsets.begin(), out.offsets.end() - 1);
+        out.indices.resize(out.offsets.back());
+        for(std::size_t b=0; b<hits.size(); ++b)
+        {
+            for(std::size_t i=0; i<hits[b].size(); ++i)
             {
-                partner.entry.push_back(entries.at(next.first).first);
-                partner.box =
-                    expand(partner.box, entries.at(next.first).second, this->boundary_);
+                out.indices[cursor[hits[b][i].first]++] = hits[b][i].second;
             }
-            entries.erase(entries.begin() + next.first);
         }
-        return partner;
+        return;
     }
 
-    // ConstIterator::value_type should be
-    // std::pair<std::size_t, {indexable_type or aabb_type}>
-    template<typename ConstIterator>
-    boost::array<std::size_t, 2>
-    pick_seeds(const ConstIterator first, const ConstIterator last)
+    // the k-th bit of the mask corresponds to group[k], {query, its index}.
+    template<typename Query>
+    void query_batch_impl(const std::size_t node_idx,
+            const std::vector<std::pair<Query, std::size_t> >& group,
+            const batch_mask_type mask,
+            batch_hits_type& hits) const
     {
-        assert(std::distance(first, last) >= 2);
+        const node_type& node = tree_.at(node_idx);
 
-        boost::array<std::size_t, 2> retval;
+        // test all the entries for each query, and then transpose the masks
+        boost::array<batch_mask_type, max_entry> child_masks;
+        std::fill(child_masks.begin(), child_masks.end(), batch_mask_type(0));
+        for(batch_mask_type m = mask; m != 0; m &= (m - 1))
+        {
+            const std::size_t k = detail::lowest_bit(m);
+            for(entry_mask_type e = this->match_boxes(group[k].first, node);
+                e != 0; e &= (e - 1))
+            {
+                child_masks[detail::lowest_bit(e)] |= (batch_mask_type(1) << k);
+            }
+        }
 
-        scalar_type max_d = 0;
-        for(ConstIterator iter(first), iend(last - 1); iter != iend; ++iter)
+        for(std::size_t j=0; j<node.entry.size(); ++j)
         {
-            for(ConstIterator jter(iter+1), jend(last); jter != jend; ++jter)
+            const batch_mask_type child_mask = child_masks[j];
+            if(child_mask == 0) {continue;}
+
+            const std::size_t next = node.entry[j];
+            if(!node.is_leaf)
+            {
+                this->query_batch_impl(next, group, child_mask, hits);
+                continue;
+            }
+            for(batch_mask_type m = child_mask; m != 0; m &= (m - 1))
             {
-                const aabb_type E1I = make_aabb(iter->second);
-                const aabb_type E2I = make_aabb(jter->second);
-                const aabb_type J = expand(E1I, E2I, this->boundary_);
-                const scalar_type d =
-                    area(J, boundary_) - area(E1I, boundary_) - area(E2I, boundary_);
-//                 assert(d >= 0); // if two overlaps, ...
-                if(max_d < d)
+                const std::pair<Query, std::size_t>& q =
+                    group[detail::lowest_bit(m)];
+                if(this->match_value(q.first, next))
                 {
-                    max_d = d;
-                    retval[0] = std::distance(first, iter);
-                    retval[1] = std::distance(first, jter);
+                    hits.push_back(std::make_pair(q.second, next));
                 }
             }
         }
-        return retval;
+        return;
     }
 
-    // ConstIterator::value_type should be
-    // std::pair<std::size_t, {indexable_type or aabb_type}>
-    template<typename ConstIterator>
-    std::pair<std::size_t, bool> pick_next(
-            const ConstIterator first, const ConstIterator last,
-            const aabb_type& node, const aabb_type& ptnr)
+    template<typename Query>
+    bool exists_impl(const std::size_t node_idx, const Query& q) const
     {
-        assert(first != last);
-        bool is_node;
-        std::size_t idx;
-        scalar_type max_dd = -1;
-        for(ConstIterator iter(first); iter != last; ++iter)
+        const node_type& node = tree_.at(node_idx);
+        const entry_mask_type mask = this->match_entries(q, node);
+        if(node.is_leaf)
         {
-            const aabb_type box1 =
-                expand(node, make_aabb(iter->second), this->boundary_);
-            const aabb_type box2 =
-                expand(ptnr, make_aabb(iter->second), this->boundary_);
-
-            const scalar_type d1 = area(box1, this->boundary_) - area(node, this->boundary_);
-            const scalar_type d2 = area(box2, this->boundary_) - area(ptnr, this->boundary_);
-            const scalar_type dd = d1 - d2;
-            if(max_dd < std::abs(dd))
+            return mask != 0;
+        }
+        for(entry_mask_type m = mask; m != 0; m &= (m - 1))
+        {
+            if(this->exists_impl(node.entry[detail::lowest_bit(m)], q))
             {
-                max_dd = std::abs(dd);
-                idx = std::distance(first, iter);
-                is_node = (dd < 0);
+                return true;
             }
         }
-        return std::make_pair(idx, is_node);
+        return false;
     }
 
-    // split nodes because of new node NN by quadratic algorithm
-    std::size_t split_node(const std::size_t P, const std::size_t NN)
+    template<typename Query>
+    std::size_t count_impl(const std::size_t node_idx, const Query& q) const
     {
-        node_type& node = tree_.at(P);
-        const std::size_t PP = this->add_node(node_type(false, node.parent));
-        node_type& partner = tree_.at(PP);
-
-        typedef typename gen_static_vector<std::pair<std::size_t, aabb_type>,
-                max_entry+1>::type temporal_entry_container;
-        temporal_entry_container entries;
-        entries.push_back(std::make_pair(NN, tree_.at(NN).box));
-
-        for(typename node_type::const_iterator
-                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+        std::size_t retval = 0;
+        const node_type& node = tree_.at(node_idx);
+        for(entry_mask_type m = this->match_entries(q, node); m != 0; m &= (m - 1))
         {
-            entries.push_back(std::make_pair(*i, tree_.at(*i).box));
-
+            retval += node.is_leaf ? 1 :
+                this->count_impl(node.entry[detail::lowest_bit(m)], q);
         }
-        node.entry.clear();
-        partner.entry.clear(); // for make it sure
-
-        /* assign first 2 entries to node and partner */{
-            const boost::array<std::size_t, 2> seeds =
-                this->pick_seeds(entries.begin(), entries.end());
-
-               node.entry.push_back(entries.at(seeds[0]).first);
-            partner.entry.push_back(entries.at(seeds[1]).first);
+        return retval;
+    }
 
-            tree_.at(entries.at(seeds[0]).first).parent = P;
-            tree_.at(entries.at(seeds[1]).first).parent = PP;
+  private:
 
-               node.box = entries.at(seeds[0]).second;// these are AABB.
-            partner.box = entries.at(seeds[1]).second;
+    template<typename OutputIterator>
+    struct output_visitor
+    {
+        explicit output_visitor(OutputIterator o): out(o){}
 
-            // remove them from entries pool
-            entries.erase(entries.begin() + std::min(seeds[0], seeds[1]));
-            entries.erase(entries.begin() + std::max(seeds[0], seeds[1]) - 1);
+        bool operator()(const value_type& v, const std::size_t)
+        {
+            *out = v;
+            ++out;
+            return true;
         }
+        OutputIterator out;
+    };
+
 
-        while(!entries.empty())
+    // report the pairs in the subtree N.
+    template<typename RadiusGetter, typename Function>
+    void self_join(const std::size_t N, const scalar_type cutoff,
+                   const scalar_type threshold_sq,
+                   RadiusGetter& radius, Function& f) const
+    {
+        const node_type& node = tree_.at(N);
+        for(typename node_type::const_iterator
+                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
         {
-            if(min_entry > node.entry.size() &&
-               min_entry - node.entry.size() >= entries.size())
+            if(node.is_leaf)
             {
-                for(typename temporal_entry_container::const_iterator
-                        i(entries.begin()), e(entries.end()); i != e; ++i)
+                for(typename node_type::const_iterator j(i+1); j != e; ++j)
                 {
-                    node.entry.push_back(i->first);
-                    node.box = expand(node.box, i->second, this->boundary_);
+                    this->join_values(*i, *j, cutoff, radius, f);
                 }
-                return PP;
+                continue;
             }
-            if(min_entry > partner.entry.size() &&
-               min_entry - partner.entry.size() >= entries.size())
+            this->self_join(*i, cutoff, threshold_sq, radius, f);
+            for(typename node_type::const_iterator j(i+1); j != e; ++j)
             {
-                for(typename temporal_entry_container::const_iterator
-                        i(entries.begin()), e(entries.end()); i != e; ++i)
+                if(distance_sq(tree_.at(*i).box, tree_.at(*j).box,
+                               this->boundary_) <= threshold_sq)
                 {
-                    partner.entry.push_back(i->first);
-                    partner.box = expand(partner.box, i->second, this->boundary_);
+                    this->dual_join(*i, *j, cutoff, threshold_sq, radius, f);
                 }
-                return PP;
             }
-
-            const std::pair<std::size_t, bool> next =
-                this->pick_next(entries.begin(), entries.end(), node.box, partner.box);
-            if(next.second) // next is partner
-            {
-                node.entry.push_back(entries.at(next.first).first);
-                tree_.at(entries.at(next.first).first).parent = P;
-                node.box =
-                    expand(node.box, entries.at(next.first).second, this->boundary_);
-            }
-            else // next is for partner
-            {
-                partner.entry.push_back(entries.at(next.first).first);
-                tree_.at(entries.at(next.first).first).parent = PP;
-                partner.box =
-                    expand(partner.box, entries.at(next.first).second, this->boundary_);
-            }
-            entries.erase(entries.begin() + next.first);
         }
-        tree_.at(P) = node;
-        tree_.at(PP) = partner;
-        return PP;
+        return;
     }
 
-    template<typename Query, typename OutputIterator>
-    void query_impl(std::size_t node_idx, Query q, OutputIterator out) const
+    // report the pairs between the disjoint subtrees N1 and N2. all the leaves
+    // are at the same depth, so both are leaves or both are not.
+    template<typename RadiusGetter, typename Function>
+    void dual_join(const std::size_t N1, const std::size_t N2,
+                   const scalar_type cutoff, const scalar_type threshold_sq,
+                   RadiusGetter& radius, Function& f) const
     {
-        const node_type& node = tree_.at(node_idx);
-        if(node.is_leaf)
+        const node_type& node1 = tree_.at(N1);
+        const node_type& node2 = tree_.at(N2);
+        for(typename node_type::const_iterator
+                i(node1.entry.begin()), ie(node1.entry.end()); i != ie; ++i)
         {
             for(typename node_type::const_iterator
-                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
+                    j(node2.entry.begin()), je(node2.entry.end()); j != je; ++j)
             {
-                value_type const& val = container_.at(*i);
-                if(q.match(indexable_getter_(val), this->boundary_) && q.match(val))
+                if(node1.is_leaf)
                 {
-                    *out = val;
-                    ++out;
+                    this->join_values(*i, *j, cutoff, radius, f);
                 }
-            }
-        }
-        else
-        {
-            for(typename node_type::const_iterator
-                i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
-            {
-                const std::size_t next = *i;
-                if(intersects(q.box(), tree_.at(next).box, this->boundary_))
+                else if(distance_sq(tree_.at(*i).box, tree_.at(*j).box,
+                                    this->boundary_) <= threshold_sq)
                 {
-                    this->query_impl(next, q, out);
+                    this->dual_join(*i, *j, cutoff, threshold_sq, radius, f);
                 }
             }
         }
         return;
     }
 
-  private:
-
-    std::size_t level_of(std::size_t node_idx) const
+    template<typename RadiusGetter, typename Function>
+    BOOST_FORCEINLINE
+    void join_values(const std::size_t i, const std::size_t j,
+                     const scalar_type cutoff,
+                     RadiusGetter& radius, Function& f) const
     {
-        std::size_t level = 0;
-        while(!(tree_.at(node_idx).is_leaf))
+        if(this->is_dead(i) || this->is_dead(j)) {return;}
+
+        const value_type& vi = container_.at(i);
+        const value_type& vj = container_.at(j);
+        const point_type dr = restrict_direction(
+                make_aabb(indexable_getter_(vj)).center -
+                make_aabb(indexable_getter_(vi)).center, this->boundary_);
+        scalar_type dist_sq(0);
+        for(std::size_t k=0; k<dimension; ++k)
+        {
+            dist_sq += dr[k] * dr[k];
+        }
+        const scalar_type threshold = radius(vi) + radius(vj) + cutoff;
+        if(dist_sq <= threshold * threshold)
         {
-            ++level;
-            node_idx = tree_.at(node_idx).entry.front();
+            f(vi, vj, dr);
         }
-        return level;
+        return;
     }
 
-    void re_insert(const std::size_t N)
+    BOOST_FORCEINLINE
+    std::size_t level_of(const std::size_t node_idx) const
+    {
+        return tree_.at(node_idx).level;
+    }
+
+    // copy the box of the node C to its entry in the parent P.
+    void sync_entry(const std::size_t P, const std::size_t C)
     {
-        // reset connection to the parent!
+        node_type& parent = tree_.at(P);
+        const typename node_type::const_iterator found =
+            std::find(parent.entry.begin(), parent.entry.end(), C);
+        assert(found != parent.entry.end());
+        parent.set_entry_box(found - parent.entry.begin(), tree_.at(C).box);
+        return;
+    }
 
+    void re_insert(const std::size_t N)
+    {
         // insert node to its proper parent. to find the parent of this node N,
         // add 1 to level. root node should NOT come here.
-        const std::size_t lvl = level_of(N) + 1;
-        const aabb_type&  entry = tree_.at(N).box;
-        const std::size_t L = choose_node_with_level(entry, lvl);
+        const std::size_t lvl   = level_of(N) + 1;
+        const aabb_type   entry = tree_.at(N).box;
+        const std::size_t L     = choose_node_with_level(entry, lvl);
 
         if(tree_.at(L).has_enough_storage())
         {
+            tree_.at(L).set_entry_box(tree_.at(L).entry.size(), entry);
             tree_.at(L).entry.push_back(N);
             tree_.at(N).parent = L;
-            expand(tree_.at(L).box, entry, this->boundary_);
+            tree_.at(L).box = expand(tree_.at(L).box, entry, this->boundary_);
             this->adjust_tree(L);
         }
         else
         {
-            const std::size_t LL = this->split_node(L, N);
-            this->adjust_tree(L, LL);
+            tree_.at(N).parent = tree_.at(L).parent;
+            if(!this->reinsert_node(L, N, algorithm_tag()))
+            {
+                const std::size_t LL = this->split_node(L, N);
+                this->adjust_tree(L, LL);
+            }
         }
         return;
     }
@@ -718,26 +2566,7 @@ class rtree
 
         while(level_of(node_idx) != lvl)
         {
-            scalar_type diff_area_min = std::numeric_limits<scalar_type>::max();
-            scalar_type area_min      = std::numeric_limits<scalar_type>::max();
-
-            const node_type& node = this->tree_.at(node_idx);
-            for(typename node_type::const_iterator
-                    i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
-            {
-                const scalar_type area_initial = area(tree_.at(*i).box, this->boundary_);
-                const aabb_type box = expand(tree_.at(*i).box, entry, this->boundary_);
-
-                const scalar_type area_expanded = area(box, this->boundary_);
-                const scalar_type diff_area     = area_expanded - area_initial;
-                if(diff_area < diff_area_min ||
-                   (diff_area == diff_area_min && area_expanded < area_min))
-                {
-                    node_idx = *i;
-                    diff_area_min = diff_area;
-                    area_min = std::min(area_expanded, area_min);
-                }
-            }
+            node_idx = this->choose_subtree(node_idx, entry, algorithm_tag());
         }
         return node_idx;
     }
@@ -747,36 +2576,253 @@ class rtree
         assert(!node.entry.empty());
         if(node.is_leaf)
         {
-            typename node_type::const_iterator i(node.entry.begin());
-            node.box = indexable_getter_(this->container_.at(*i));
-            ++i;
-            for(typename node_type::const_iterator e(node.entry.end()); i != e; ++i)
+            aabb_type box = this->value_box(node.entry.front());
+            for(std::size_t k=0; k<node.entry.size(); ++k)
             {
-                node.box = expand(node.box,
-                        indexable_getter_(this->container_.at(*i)), this->boundary_);
+                const aabb_type value_box = this->value_box(node.entry[k]);
+                node.set_entry_box(k, value_box);
+                box = expand(box, value_box, this->boundary_);
             }
+            node.box = box;
         }
         else
         {
-            typename node_type::const_iterator i = node.entry.begin();
-            node.box = this->tree_.at(*i).box;
-            ++i;
-            for(typename node_type::const_iterator e(node.entry.end()); i != e; ++i)
+            aabb_type box = this->tree_.at(node.entry.front()).box;
+            for(std::size_t k=0; k<node.entry.size(); ++k)
+            {
+                const aabb_type& child = this->tree_.at(node.entry[k]).box;
+                node.set_entry_box(k, child);
+                box = expand(box, child, this->boundary_);
+            }
+            node.box = box;
+        }
+        return;
+    }
+
+    // the box of the value in the leaf. it is inflated in fattened AABB mode.
+    BOOST_FORCEINLINE
+    aabb_type value_box(const std::size_t vidx) const
+    {
+        return (this->skin_ > 0) ? this->fat_boxes_[vidx] :
+            aabb_type(make_aabb(indexable_getter_(this->container_[vidx])));
+    }
+
+    aabb_type fatten(const value_type& v) const
+    {
+        aabb_type box = make_aabb(indexable_getter_(v));
+        for(std::size_t i=0; i<dimension; ++i)
+        {
+            box.radius[i] += this->skin_;
+        }
+        return box;
+    }
+
+    // recalculate all the boxes in the subtree
+    void refit(const std::size_t N)
+    {
+        node_type& node = tree_.at(N);
+        if(!node.is_leaf)
+        {
+            for(typename node_type::const_iterator
+                    i(node.entry.begin()), e(node.entry.end()); i != e; ++i)
             {
-                node.box = expand(node.box, this->tree_.at(*i).box, this->boundary_);
+                this->refit(*i);
             }
         }
+        this->condense_box(tree_.at(N));
         return;
     }
 
+    // test the value in a leaf. without exact recheck in fattened AABB mode,
+    // the fat box is tested instead.
+    template<typename Query>
+    BOOST_FORCEINLINE
+    bool match_value(const Query& q, const std::size_t vidx) const
+    {
+        if(this->is_dead(vidx)) {return false;}
+
+        value_type const& val = container_[vidx];
+        if(this->skin_ > 0 && !this->exact_recheck_)
+        {
+            return q.match(this->fat_boxes_[vidx], this->boundary_) && q.match(val);
+        }
+        return q.match(indexable_getter_(val), this->boundary_) && q.match(val);
+    }
+
+    // bit k is set if the box of the k-th entry matches the query as a node.
+    template<typename Query>
+    entry_mask_type match_boxes(const Query& q, const node_type& node) const
+    {
+        entry_mask_type mask = 0;
+        for(std::size_t k=0; k<node.entry.size(); ++k)
+        {
+            if(q.match_node(node.entry_box(k), this->boundary_))
+            {
+                mask |= (entry_mask_type(1) << k);
+            }
+        }
+        return mask;
+    }
+    template<typename Query>
+    entry_mask_type match_boxes(
+            const detail::kernel_query<Query, detail::kernel_box<node_type> >& q,
+            const node_type& node) const
+    {
+        return detail::intersects_mask(node, q.kernel, this->boundary_);
+    }
+    template<typename Query>
+    entry_mask_type match_boxes(
+            const detail::kernel_query<Query, detail::kernel_sphere<node_type> >& q,
+            const node_type& node) const
+    {
+        return detail::within_distance_mask(node, q.kernel, this->boundary_);
+    }
+    // sure has the entries whose boxes, before the rounding, surely match.
+    template<typename Query>
+    entry_mask_type match_boxes(
+            const detail::kernel_query<Query, detail::kernel_box<node_type> >& q,
+            const node_type& node, entry_mask_type& sure) const
+    {
+        return detail::intersects_mask(node, q.kernel, this->boundary_, sure);
+    }
+    template<typename Query>
+    entry_mask_type match_boxes(
+            const detail::kernel_query<Query, detail::kernel_sphere<node_type> >& q,
+            const node_type& node, entry_mask_type& sure) const
+    {
+        return detail::within_distance_mask(node, q.kernel, this->boundary_, sure);
+    }
+
+    // bit k is set if the k-th entry matches the query. the boxes stored in
+    // the node are tested first, so a value is looked up only if its box
+    // matches.
+    template<typename Query>
+    entry_mask_type match_entries(const Query& q, const node_type& node) const
+    {
+        if(!node.is_leaf)
+        {
+            return this->match_boxes(q, node);
+        }
+        entry_mask_type mask = 0;
+        for(std::size_t k=0; k<node.entry.size(); ++k)
+        {
+            if(this->match_leaf_entry(q, node, k, leaf_holds_indexable()))
+            {
+                mask |= (entry_mask_type(1) << k);
+            }
+        }
+        return mask;
+    }
+    entry_mask_type match_entries(const typename detail::kernel_query_of<node_type,
+            query::query_intersects_box<point_type> >::type& q,
+            const node_type& node) const
+    {
+        return this->match_exact_entries(q, node);
+    }
+    entry_mask_type match_entries(const typename detail::kernel_query_of<node_type,
+            query::query_within_distance<point_type> >::type& q,
+            const node_type& node) const
+    {
+        return this->match_exact_entries(q, node);
+    }
+
+    // the query in the form that the traversal uses
+    template<typename Query>
+    typename detail::kernel_query_of<node_type, Query>::type
+    kernel_form(const Query& q) const
+    {
+        return detail::kernel_query_of<node_type, Query>::make(q, this->boundary_);
+    }
+
+    // for the queries that test a rectangle in the same way for a node and
+    // for a value. if the indexable is not fattened, the leaf entries that the
+    // kernel tells surely match do not need to be tested twice.
+    template<typename Query>
+    entry_mask_type match_exact_entries(const Query& q, const node_type& node) const
+    {
+        entry_mask_type sure = 0;
+        entry_mask_type mask = this->match_boxes(q, node, sure);
+        if(!node.is_leaf)
+        {
+            return mask;
+        }
+        if(!boost::is_same<indexable_type, aabb_type>::value || this->skin_ != 0)
+        {
+            sure = 0;
+        }
+        for(entry_mask_type m = mask; m != 0; m &= (m - 1))
+        {
+            const std::size_t k    = detail::lowest_bit(m);
+            const std::size_t vidx = node.entry[k];
+            if(((sure >> k) & 1u) ?
+               (this->is_dead(vidx) || !q.match(container_[vidx])) :
+               !this->match_value(q, vidx))
+            {
+                mask &= ~(entry_mask_type(1) << k);
+            }
+        }
+        return mask;
+    }
+
+    // if the indexable is a rectangle, the box stored in the leaf is the
+    // indexable itself unless it is fattened or rounded. it does not need to
+    // be tested twice.
+    typedef boost::integral_constant<bool,
+        boost::is_same<indexable_type, aabb_type>::value && node_type::exact_boxes
+        > leaf_holds_indexable;
+
+    template<typename Query>
+    BOOST_FORCEINLINE
+    bool match_leaf_entry(const Query& q, const node_type& node,
+                          const std::size_t k, boost::true_type) const
+    {
+        if(this->skin_ > 0)
+        {
+            return this->match_leaf_entry(q, node, k, boost::false_type());
+        }
+        const std::size_t vidx = node.entry[k];
+        return !this->is_dead(vidx) &&
+               q.match(node.entry_box(k), this->boundary_) &&
+               q.match(container_[vidx]);
+    }
+    template<typename Query>
+    BOOST_FORCEINLINE
+    bool match_leaf_entry(const Query& q, const node_type& node,
+                          const std::size_t k, boost::false_type) const
+    {
+        return q.match_node(node.entry_box(k), this->boundary_) &&
+               this->match_value(q, node.entry[k]);
+    }
+
+    BOOST_FORCEINLINE
+    bool is_dead(const std::size_t vidx) const BOOST_NOEXCEPT_OR_NOTHROW
+    {
+        return this->num_dead_ != 0 && this->dead_[vidx];
+    }
+
   private:
 
+    // the indices are stored in node_index_type, and nil is reserved.
+    static void check_index_range(const std::size_t n)
+    {
+        if(n >= nil)
+        {
+            throw std::length_error("perior::rtree: the number of values or "
+                                    "nodes exceeds the range of the index type");
+        }
+        return;
+    }
+
     std::size_t add_value(const value_type& v)
     {
         if(overwritable_values_.empty())
         {
             const std::size_t idx = container_.size();
+            check_index_range(idx);
             container_.push_back(v);
+            leaf_of_.push_back(static_cast<std::size_t>(nil));
+            dead_.push_back(false);
+            if(this->skin_ > 0) {fat_boxes_.push_back(this->fatten(v));}
             return idx;
         }
         else
@@ -784,11 +2830,13 @@ class rtree
             const std::size_t idx = overwritable_values_.back();
             overwritable_values_.pop_back();
             container_.at(idx) = v;
+            if(this->skin_ > 0) {fat_boxes_.at(idx) = this->fatten(v);}
             return idx;
         }
     }
     void erase_value(const std::size_t i)
     {
+        leaf_of_.at(i) = nil;
         overwritable_values_.push_back(i);
         return;
     }
@@ -798,6 +2846,7 @@ class rtree
         if(overwritable_nodes_.empty())
         {
             const std::size_t idx = tree_.size();
+            check_index_range(idx);
             tree_.push_back(n);
             return idx;
         }
@@ -817,6 +2866,8 @@ class rtree
 
   private:
 
+    friend struct detail::rtree_access;
+
     std::size_t       root_;
     equal_to_type     equal_to_;
     boundary_type     boundary_;
@@ -825,6 +2876,21 @@ class rtree
     index_buffer_type overwritable_values_;
     index_buffer_type overwritable_nodes_;
     indexable_getter_type indexable_getter_;
+    std::size_t       reinserted_levels_; // used by R*-tree while inserting
+
+    // leaf_of_[i] is the leaf that contains container_[i], or nil if removed.
+    std::vector<node_index_type> leaf_of_;
+    // fattened AABB mode. fat_boxes_[i] is the box of container_[i] in leaves.
+    std::vector<aabb_type> fat_boxes_;
+    scalar_type            skin_; // disabled if 0
+    bool                   exact_recheck_;
+    skin_statistics        skin_stats_;
+    // lazy removal mode. dead_[i] is true if container_[i] is removed but
+    // still in a leaf.
+    std::vector<bool>      dead_;
+    bool                   lazy_removal_;
+    std::size_t            max_dead_; // max number of dead values in a leaf
+    std::size_t            num_dead_;
 };
 
 
@@ -0,0 +1,187 @@
+#ifndef PERIOR_TREE_SPATIAL_JOIN
+#define PERIOR_TREE_SPATIAL_JOIN
+#include <periortree/rtree.hpp>
+#include <periortree/intersects.hpp>
+#include <utility>
+
+namespace perior
+{
+
+// spatial_join writes std::pair<TreeA::value_type, TreeB::value_type>.
+struct value_pairs {};
+// spatial_join writes std::pair<std::size_t, std::size_t>. each of them can be
+// converted to the value by rtree::at.
+struct index_pairs {};
+
+namespace detail
+{
+
+// accessor to the internal of rtree used by the free functions.
+struct rtree_access
+{
+    template<typename Tree>
+    static typename Tree::tree_type const& nodes(const Tree& t)
+    {
+        return t.tree_;
+    }
+    template<typename Tree>
+    static std::size_t root(const Tree& t)
+    {
+        return t.root_;
+    }
+    template<typename Tree>
+    static typename Tree::aabb_type value_box(const Tree& t, const std::size_t i)
+    {
+        return make_aabb(t.indexable_getter_(t.container_.at(i)));
+    }
+    template<typename Tree>
+    static bool is_dead(const Tree& t, const std::size_t i)
+    {
+        return t.is_dead(i);
+    }
+};
+
+template<typename TreeA, typename TreeB, typename OutputIterator>
+struct join_value_emitter
+{
+    join_value_emitter(const TreeA& a, const TreeB& b, OutputIterator o)
+        : tree_a(a), tree_b(b), out(o)
+    {}
+
+    void operator()(const std::size_t i, const std::size_t j)
+    {
+        *out = std::make_pair(tree_a.at(i), tree_b.at(j));
+        ++out;
+    }
+
+    TreeA const&   tree_a;
+    TreeB const&   tree_b;
+    OutputIterator out;
+};
+
+template<typename OutputIterator>
+struct join_index_emitter
+{
+    explicit join_index_emitter(OutputIterator o): out(o){}
+
+    void operator()(const std::size_t i, const std::size_t j)
+    {
+        *out = std::make_pair(i, j);
+        ++out;
+    }
+
+    OutputIterator out;
+};
+
+// traverse the subtrees Na and Nb at the same time. the pair of nodes whose
+// boxes do not intersect is pruned at once.
+template<typename TreeA, typename TreeB, typename Emitter>
+void spatial_join_impl(const TreeA& a, const std::size_t Na,
+                       const TreeB& b, const std::size_t Nb, Emitter& emit)
+{
+    typedef typename TreeA::node_type node_a_type;
+    typedef typename TreeB::node_type node_b_type;
+    const node_a_type& node_a = rtree_access::nodes(a).at(Na);
+    const node_b_type& node_b = rtree_access::nodes(b).at(Nb);
+    const typename TreeA::boundary_type& bdry = a.boundary();
+
+    if(node_a.is_leaf && node_b.is_leaf)
+    {
+        for(typename node_a_type::const_iterator
+                i(node_a.entry.begin()), ie(node_a.entry.end()); i != ie; ++i)
+        {
+            if(rtree_access::is_dead(a, *i)) {continue;}
+            const typename TreeA::aabb_type box_a = rtree_access::value_box(a, *i);
+            if(!intersects(box_a, node_b.box, bdry)) {continue;}
+
+            for(typename node_b_type::const_iterator
+                    j(node_b.entry.begin()), je(node_b.entry.end()); j != je; ++j)
+            {
+                if(!rtree_access::is_dead(b, *j) &&
+                   intersects(box_a, rtree_access::value_box(b, *j), bdry))
+                {
+                    emit(*i, *j);
+                }
+            }
+        }
+    }
+    else if(node_b.is_leaf)
+    {
+        for(typename node_a_type::const_iterator
+                i(node_a.entry.begin()), ie(node_a.entry.end()); i != ie; ++i)
+        {
+            if(intersects(rtree_access::nodes(a).at(*i).box, node_b.box, bdry))
+            {
+                spatial_join_impl(a, *i, b, Nb, emit);
+            }
+        }
+    }
+    else if(node_a.is_leaf)
+    {
+        for(typename node_b_type::const_iterator
+                j(node_b.entry.begin()), je(node_b.entry.end()); j != je; ++j)
+        {
+            if(intersects(node_a.box, rtree_access::nodes(b).at(*j).box, bdry))
+            {
+                spatial_join_impl(a, Na, b, *j, emit);
+            }
+        }
+    }
+    else // descend both
+    {
+        for(typename node_a_type::const_iterator
+                i(node_a.entry.begin()), ie(node_a.entry.end()); i != ie; ++i)
+        {
+            const typename TreeA::aabb_type& box_a = rtree_access::nodes(a).at(*i).box;
+            if(!intersects(box_a, node_b.box, bdry)) {continue;}
+
+            for(typename node_b_type::const_iterator
+                    j(node_b.entry.begin()), je(node_b.entry.end()); j != je; ++j)
+            {
+                if(intersects(box_a, rtree_access::nodes(b).at(*j).box, bdry))
+                {
+                    spatial_join_impl(a, *i, b, *j, emit);
+                }
+            }
+        }
+    }
+    return;
+}
+
+template<typename TreeA, typename TreeB, typename Emitter>
+void spatial_join_dispatch(const TreeA& a, const TreeB& b, Emitter& emit)
+{
+    BOOST_STATIC_ASSERT_MSG((boost::is_same<typename TreeA::boundary_type,
+                                            typename TreeB::boundary_type>::value),
+                            "spatial_join: the trees should share the boundary");
+    if(a.empty() || b.empty()) {return;}
+    spatial_join_impl(a, rtree_access::root(a), b, rtree_access::root(b), emit);
+    return;
+}
+
+} // detail
+
+// find all the pairs of values in tree_a and tree_b whose boxes intersect.
+// both trees should be on the same boundary; the one of tree_a is used.
+template<typename TreeA, typename TreeB, typename OutputIterator>
+OutputIterator
+spatial_join(const TreeA& tree_a, const TreeB& tree_b, OutputIterator out,
+             value_pairs = value_pairs())
+{
+    detail::join_value_emitter<TreeA, TreeB, OutputIterator> emit(tree_a, tree_b, out);
+    detail::spatial_join_dispatch(tree_a, tree_b, emit);
+    return emit.out;
+}
+
+template<typename TreeA, typename TreeB, typename OutputIterator>
+OutputIterator
+spatial_join(const TreeA& tree_a, const TreeB& tree_b, OutputIterator out,
+             index_pairs)
+{
+    detail::join_index_emitter<OutputIterator> emit(out);
+    detail::spatial_join_dispatch(tree_a, tree_b, emit);
+    return emit.out;
+}
+
+} // perior
+#endif//PERIOR_TREE_SPATIAL_JOIN
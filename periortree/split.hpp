@@ -0,0 +1,467 @@
+#ifndef PERIOR_TREE_SPLIT_HPP
+#define PERIOR_TREE_SPLIT_HPP
+#include <periortree/parameters.hpp>
+#include <periortree/rectangle.hpp>
+#include <periortree/indexable.hpp>
+#include <periortree/expand.hpp>
+#include <periortree/area.hpp>
+#include <periortree/margin.hpp>
+#include <periortree/overlap.hpp>
+#include <boost/array.hpp>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <vector>
+#include <cmath>
+
+namespace perior
+{
+namespace detail
+{
+
+// ConstIterator::value_type should be
+// std::pair<std::size_t, {indexable_type or aabb_type}>.
+// pick_seeds returns the positions of the first entries of the two groups.
+// pick_next returns the position of the entry to be assigned next and whether
+// it goes to the first group (true) or the second (false).
+
+// ----------------------------------------------------------------------------
+// quadratic
+
+template<typename ConstIterator, typename boundaryT>
+boost::array<std::size_t, 2>
+pick_seeds(const ConstIterator first, const ConstIterator last,
+           const boundaryT& b, quadratic_tag)
+{
+    typedef typename boundaryT::point_type point_type;
+    typedef typename traits::scalar_type_of<point_type>::type scalar_type;
+    typedef rectangle<point_type> aabb_type;
+    assert(std::distance(first, last) >= 2);
+
+    boost::array<std::size_t, 2> retval = {{0, 1}};
+
+    scalar_type max_d = -std::numeric_limits<scalar_type>::max();
+    for(ConstIterator iter(first), iend(last - 1); iter != iend; ++iter)
+    {
+        for(ConstIterator jter(iter+1), jend(last); jter != jend; ++jter)
+        {
+            const aabb_type E1I = make_aabb(iter->second);
+            const aabb_type E2I = make_aabb(jter->second);
+            const aabb_type J = expand(E1I, E2I, b);
+            const scalar_type d = area(J, b) - area(E1I, b) - area(E2I, b);
+            if(max_d < d)
+            {
+                max_d = d;
+                retval[0] = std::distance(first, iter);
+                retval[1] = std::distance(first, jter);
+            }
+        }
+    }
+    return retval;
+}
+
+template<typename ConstIterator, typename boundaryT>
+std::pair<std::size_t, bool>
+pick_next(const ConstIterator first, const ConstIterator last,
+          const rectangle<typename boundaryT::point_type>& node,
+          const rectangle<typename boundaryT::point_type>& ptnr,
+          const boundaryT& b, quadratic_tag)
+{
+    typedef typename boundaryT::point_type point_type;
+    typedef typename traits::scalar_type_of<point_type>::type scalar_type;
+    typedef rectangle<point_type> aabb_type;
+    assert(first != last);
+
+    const scalar_type area_node = area(node, b);
+    const scalar_type area_ptnr = area(ptnr, b);
+
+    bool is_node = true;
+    std::size_t idx = 0;
+    scalar_type max_dd = -1;
+    for(ConstIterator iter(first); iter != last; ++iter)
+    {
+        const aabb_type box1 = expand(node, make_aabb(iter->second), b);
+        const aabb_type box2 = expand(ptnr, make_aabb(iter->second), b);
+
+        const scalar_type d1 = area(box1, b) - area_node;
+        const scalar_type d2 = area(box2, b) - area_ptnr;
+        const scalar_type dd = d1 - d2;
+        if(max_dd < std::abs(dd))
+        {
+            max_dd  = std::abs(dd);
+            idx     = std::distance(first, iter);
+            is_node = (dd < 0);
+        }
+    }
+    return std::make_pair(idx, is_node);
+}
+
+// ----------------------------------------------------------------------------
+// linear
+
+// find the pair that has the greatest normalized separation along any axis.
+// on the periodic cell, the entries are unwrapped around the center of the
+// box that covers all of them before the sides are compared.
+template<typename ConstIterator, typename boundaryT>
+boost::array<std::size_t, 2>
+pick_seeds(const ConstIterator first, const ConstIterator last,
+           const boundaryT& b, linear_tag)
+{
+    typedef typename boundaryT::point_type point_type;
+    typedef typename traits::scalar_type_of<point_type>::type scalar_type;
+    typedef rectangle<point_type> aabb_type;
+    const std::size_t dim = traits::dimension<point_type>::value;
+    assert(std::distance(first, last) >= 2);
+
+    aabb_type whole = make_aabb(first->second);
+    for(ConstIterator iter(first + 1); iter != last; ++iter)
+    {
+        whole = expand(whole, make_aabb(iter->second), b);
+    }
+    const point_type& origin = whole.center;
+
+    boost::array<std::size_t, 2> retval = {{0, 1}};
+    scalar_type max_separation = -std::numeric_limits<scalar_type>::max();
+    for(std::size_t i=0; i<dim; ++i)
+    {
+        // highest low side, lowest high side, and the whole extent
+        std::size_t highest_low = 0, lowest_high = 0;
+        scalar_type hl = -std::numeric_limits<scalar_type>::max();
+        scalar_type lh =  std::numeric_limits<scalar_type>::max();
+        scalar_type lower = std::numeric_limits<scalar_type>::max();
+        scalar_type upper = -std::numeric_limits<scalar_type>::max();
+
+        std::size_t idx = 0;
+        for(ConstIterator iter(first); iter != last; ++iter, ++idx)
+        {
+            const aabb_type box = make_aabb(iter->second);
+            const scalar_type c =
+                origin[i] + restrict_direction(box.center - origin, b)[i];
+            const scalar_type l = c - box.radius[i];
+            const scalar_type h = c + box.radius[i];
+            if(hl < l) {hl = l; highest_low = idx;}
+            if(h < lh) {lh = h; lowest_high = idx;}
+            lower = std::min(lower, l);
+            upper = std::max(upper, h);
+        }
+        if(highest_low == lowest_high)
+        {
+            // the same entry has both sides. use the next highest low side.
+            hl = -std::numeric_limits<scalar_type>::max();
+            idx = 0;
+            for(ConstIterator iter(first); iter != last; ++iter, ++idx)
+            {
+                if(idx == lowest_high) {continue;}
+                const aabb_type box = make_aabb(iter->second);
+                const scalar_type l = origin[i] - box.radius[i] +
+                    restrict_direction(box.center - origin, b)[i];
+                if(hl < l) {hl = l; highest_low = idx;}
+            }
+        }
+
+        const scalar_type width = upper - lower;
+        const scalar_type separation = (width > 0) ? (hl - lh) / width : 0;
+        if(max_separation < separation)
+        {
+            max_separation = separation;
+            retval[0] = lowest_high;
+            retval[1] = highest_low;
+        }
+    }
+    return retval;
+}
+
+// any entry can be the next one. the last one is taken because it is the
+// cheapest to remove from the pool. it goes to the group that needs the least
+// enlargement, then the smaller one.
+template<typename ConstIterator, typename boundaryT>
+std::pair<std::size_t, bool>
+pick_next(const ConstIterator first, const ConstIterator last,
+          const rectangle<typename boundaryT::point_type>& node,
+          const rectangle<typename boundaryT::point_type>& ptnr,
+          const boundaryT& b, linear_tag)
+{
+    typedef typename boundaryT::point_type point_type;
+    typedef typename traits::scalar_type_of<point_type>::type scalar_type;
+    typedef rectangle<point_type> aabb_type;
+    assert(first != last);
+
+    const ConstIterator next = last - 1;
+    const aabb_type entry = make_aabb(next->second);
+
+    const scalar_type area_node = area(node, b);
+    const scalar_type area_ptnr = area(ptnr, b);
+    const scalar_type d1 = area(expand(node, entry, b), b) - area_node;
+    const scalar_type d2 = area(expand(ptnr, entry, b), b) - area_ptnr;
+
+    const bool is_node = (d1 < d2) || (d1 == d2 && area_node <= area_ptnr);
+    return std::make_pair(std::distance(first, next), is_node);
+}
+
+// ----------------------------------------------------------------------------
+// distribution
+
+// the box that covers all the entries. the range should not be empty.
+template<typename ConstIterator, typename boundaryT>
+rectangle<typename boundaryT::point_type>
+bounding_box_of(ConstIterator first, const ConstIterator last, const boundaryT& b)
+{
+    assert(first != last);
+    rectangle<typename boundaryT::point_type> box = make_aabb(first->second);
+    for(++first; first != last; ++first)
+    {
+        box = expand(box, first->second, b);
+    }
+    return box;
+}
+
+// Guttman's algorithm that assigns the entries one by one after the seeds.
+// the entries are moved into group1 and group2.
+template<std::size_t Min, typename Container, typename boundaryT, typename Tag>
+void guttman_split(Container& entries, Container& group1, Container& group2,
+                   const boundaryT& b, const Tag tag)
+{
+    typedef typename boundaryT::point_type point_type;
+    typedef rectangle<point_type> aabb_type;
+
+    const boost::array<std::size_t, 2> seeds =
+        pick_seeds(entries.begin(), entries.end(), b, tag);
+    group1.push_back(entries.at(seeds[0]));
+    group2.push_back(entries.at(seeds[1]));
+    aabb_type box1 = make_aabb(entries.at(seeds[0]).second);
+    aabb_type box2 = make_aabb(entries.at(seeds[1]).second);
+
+    // remove them from entries pool
+    entries.erase(entries.begin() + std::max(seeds[0], seeds[1]));
+    entries.erase(entries.begin() + std::min(seeds[0], seeds[1]));
+
+    while(!entries.empty())
+    {
+        if(Min > group1.size() && Min - group1.size() >= entries.size())
+        {
+            group1.insert(group1.end(), entries.begin(), entries.end());
+            entries.clear();
+            return;
+        }
+        if(Min > group2.size() && Min - group2.size() >= entries.size())
+        {
+            group2.insert(group2.end(), entries.begin(), entries.end());
+            entries.clear();
+            return;
+        }
+
+        const std::pair<std::size_t, bool> next =
+            pick_next(entries.begin(), entries.end(), box1, box2, b, tag);
+        if(next.second) // next is for group1
+        {
+            group1.push_back(entries.at(next.first));
+            box1 = expand(box1, entries.at(next.first).second, b);
+        }
+        else // next is for group2
+        {
+            group2.push_back(entries.at(next.first));
+            box2 = expand(box2, entries.at(next.first).second, b);
+        }
+        entries.erase(entries.begin() + next.first);
+    }
+    return;
+}
+
+template<std::size_t Min, typename Container, typename boundaryT>
+BOOST_FORCEINLINE void
+split_entries(Container& entries, Container& group1, Container& group2,
+              const boundaryT& b, quadratic_tag)
+{
+    return guttman_split<Min>(entries, group1, group2, b, quadratic_tag());
+}
+
+template<std::size_t Min, typename Container, typename boundaryT>
+BOOST_FORCEINLINE void
+split_entries(Container& entries, Container& group1, Container& group2,
+              const boundaryT& b, linear_tag)
+{
+    return guttman_split<Min>(entries, group1, group2, b, linear_tag());
+}
+
+// ----------------------------------------------------------------------------
+// R*-tree
+
+// compares entries by their sides along an axis. the sides are unwrapped
+// around the `origin` so that the order is consistent on the periodic cell.
+template<typename boundaryT>
+struct side_less
+{
+    typedef typename boundaryT::point_type point_type;
+    typedef typename traits::scalar_type_of<point_type>::type scalar_type;
+
+    side_less(const point_type& o, const std::size_t ax, const bool up,
+              const boundaryT& bd)
+        : origin(o), axis(ax), by_upper(up), b(&bd)
+    {}
+
+    template<typename Entry>
+    bool operator()(const Entry& lhs, const Entry& rhs) const
+    {
+        const scalar_type l = this->side(lhs.second.center, lhs.second.radius);
+        const scalar_type r = this->side(rhs.second.center, rhs.second.radius);
+        return l < r;
+    }
+
+    scalar_type side(const point_type& c, const point_type& r) const
+    {
+        const scalar_type x =
+            origin[axis] + restrict_direction(c - origin, *b)[axis];
+        return by_upper ? x + r[axis] : x - r[axis];
+    }
+
+    point_type       origin;
+    std::size_t      axis;
+    bool             by_upper;
+    boundaryT const* b;
+};
+
+// compute the boxes of all the distributions of the sorted entries at once.
+// prefix[k-1] covers the first k entries and suffix[k] covers the rest.
+template<typename Container, typename BoxContainer, typename boundaryT>
+void rstar_sweep(const Container& entries, BoxContainer& prefix,
+                 BoxContainer& suffix, const boundaryT& b)
+{
+    const std::size_t n = entries.size();
+    prefix.resize(n);
+    suffix.resize(n);
+    prefix.front() = entries.front().second;
+    for(std::size_t i=1; i<n; ++i)
+    {
+        prefix[i] = expand(prefix[i-1], entries[i].second, b);
+    }
+    suffix.back() = entries.back().second;
+    for(std::size_t i=n-1; i != 0; --i)
+    {
+        suffix[i-1] = expand(suffix[i], entries[i-1].second, b);
+    }
+    return;
+}
+
+// choose the axis that minimizes the sum of the margins over all the
+// distributions, then choose the distribution along the axis that minimizes
+// the overlap between the groups, then the sum of their areas.
+template<std::size_t Min, typename Container, typename boundaryT>
+void split_entries(Container& entries, Container& group1, Container& group2,
+                   const boundaryT& b, rstar_tag)
+{
+    typedef typename boundaryT::point_type point_type;
+    typedef typename traits::scalar_type_of<point_type>::type scalar_type;
+    typedef typename Container::value_type entry_type;
+    typedef std::vector<typename entry_type::second_type> box_buffer_type;
+    const std::size_t dim = traits::dimension<point_type>::value;
+    const std::size_t n   = entries.size();
+    assert(n >= 2 * Min && n >= 2);
+    const std::size_t k_min = std::max<std::size_t>(Min, 1);
+
+    const point_type origin =
+        bounding_box_of(entries.begin(), entries.end(), b).center;
+
+    box_buffer_type prefix, suffix;
+    std::size_t best_axis = 0;
+    scalar_type min_margin = std::numeric_limits<scalar_type>::max();
+    for(std::size_t axis=0; axis<dim; ++axis)
+    {
+        scalar_type margin_sum = 0;
+        for(std::size_t upper=0; upper<2; ++upper)
+        {
+            std::sort(entries.begin(), entries.end(),
+                      side_less<boundaryT>(origin, axis, upper == 1, b));
+            rstar_sweep(entries, prefix, suffix, b);
+            for(std::size_t k=k_min; k + k_min <= n; ++k)
+            {
+                margin_sum += margin(prefix[k-1], b) + margin(suffix[k], b);
+            }
+        }
+        if(margin_sum < min_margin)
+        {
+            min_margin = margin_sum;
+            best_axis  = axis;
+        }
+    }
+
+    bool        best_upper = false;
+    std::size_t best_k     = k_min;
+    scalar_type min_overlap = std::numeric_limits<scalar_type>::max();
+    scalar_type min_area    = std::numeric_limits<scalar_type>::max();
+    for(std::size_t upper=0; upper<2; ++upper)
+    {
+        std::sort(entries.begin(), entries.end(),
+                  side_less<boundaryT>(origin, best_axis, upper == 1, b));
+        rstar_sweep(entries, prefix, suffix, b);
+        for(std::size_t k=k_min; k + k_min <= n; ++k)
+        {
+            const scalar_type ovlp = overlap(prefix[k-1], suffix[k], b);
+            const scalar_type ar   = area(prefix[k-1], b) + area(suffix[k], b);
+            if(ovlp < min_overlap || (ovlp == min_overlap && ar < min_area))
+            {
+                min_overlap = ovlp;
+                min_area    = ar;
+                best_upper  = (upper == 1);
+                best_k      = k;
+            }
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              side_less<boundaryT>(origin, best_axis, best_upper, b));
+    group1.insert(group1.end(), entries.begin(), entries.begin() + best_k);
+    group2.insert(group2.end(), entries.begin() + best_k, entries.end());
+    entries.clear();
+    return;
+}
+
+// compares entries by the distance from `origin` to their centers.
+template<typename boundaryT>
+struct farther_from
+{
+    typedef typename boundaryT::point_type point_type;
+    typedef typename traits::scalar_type_of<point_type>::type scalar_type;
+
+    farther_from(const point_type& o, const boundaryT& bd): origin(o), b(&bd){}
+
+    template<typename Entry>
+    bool operator()(const Entry& lhs, const Entry& rhs) const
+    {
+        return this->distance_sq(lhs.second.center) >
+               this->distance_sq(rhs.second.center);
+    }
+
+    scalar_type distance_sq(const point_type& c) const
+    {
+        const point_type dr = restrict_direction(c - origin, *b);
+        scalar_type retval(0);
+        for(std::size_t i=0; i<traits::dimension<point_type>::value; ++i)
+        {
+            retval += dr[i] * dr[i];
+        }
+        return retval;
+    }
+
+    point_type       origin;
+    boundaryT const* b;
+};
+
+// move the Reinsert entries farthest from the center of the node into
+// `removed`, in the order of decreasing distance.
+template<std::size_t Reinsert, typename Container, typename boundaryT>
+void pick_reinserted(Container& entries, Container& removed, const boundaryT& b)
+{
+    assert(Reinsert < entries.size());
+    const typename boundaryT::point_type origin =
+        bounding_box_of(entries.begin(), entries.end(), b).center;
+
+    std::sort(entries.begin(), entries.end(), farther_from<boundaryT>(origin, b));
+    removed.insert(removed.end(), entries.begin(), entries.begin() + Reinsert);
+    entries.erase(entries.begin(), entries.begin() + Reinsert);
+    return;
+}
+
+} // detail
+} // perior
+#endif//PERIOR_TREE_SPLIT_HPP
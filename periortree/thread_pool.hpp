@@ -0,0 +1,179 @@
+#ifndef PERIOR_TREE_THREAD_POOL
+#define PERIOR_TREE_THREAD_POOL
+#if __cplusplus < 201103L
+#error "perior::thread_pool requires C++11"
+#endif
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+namespace perior
+{
+
+// fixed number of workers that run a set of independent tasks. the tasks are
+// distributed to the workers in contiguous blocks, and a worker that has
+// finished its own block steals the tasks from the tail of the others.
+// the thread that calls run() also works as the 0-th worker.
+class thread_pool
+{
+  public:
+
+    explicit thread_pool(std::size_t n = std::thread::hardware_concurrency())
+        : generation_(0), running_(0), stop_(false)
+    {
+        if(n == 0) {n = 1;}
+        for(std::size_t i=0; i<n; ++i)
+        {
+            queues_.emplace_back(new task_queue);
+        }
+        for(std::size_t i=1; i<n; ++i)
+        {
+            threads_.emplace_back(&thread_pool::worker_loop, this, i);
+        }
+    }
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        for(auto& t : threads_) {t.join();}
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    std::size_t size() const noexcept {return queues_.size();}
+
+    // call f(task, worker) for each task in [0, num_tasks) and wait for all of
+    // them. worker is in [0, size()). the first exception thrown by f is
+    // re-thrown after all the workers stopped.
+    void run(const std::size_t num_tasks,
+             std::function<void(std::size_t, std::size_t)> f)
+    {
+        const std::size_t n = this->size();
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            job_   = std::move(f);
+            error_ = nullptr;
+            for(std::size_t w=0; w<n; ++w)
+            {
+                std::lock_guard<std::mutex> qlock(queues_[w]->mtx);
+                queues_[w]->tasks.clear();
+                for(std::size_t t = num_tasks * w / n; t < num_tasks * (w+1) / n; ++t)
+                {
+                    queues_[w]->tasks.push_back(t);
+                }
+            }
+            running_ = n - 1;
+            ++generation_;
+        }
+        start_.notify_all();
+
+        this->work(0);
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            done_.wait(lock, [this]{return running_ == 0;});
+            job_ = nullptr;
+        }
+        if(error_) {std::rethrow_exception(error_);}
+        return;
+    }
+
+  private:
+
+    struct task_queue
+    {
+        std::mutex              mtx;
+        std::deque<std::size_t> tasks;
+    };
+
+    void worker_loop(const std::size_t w)
+    {
+        std::size_t seen = 0;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                start_.wait(lock, [&]{return stop_ || generation_ != seen;});
+                if(stop_) {return;}
+                seen = generation_;
+            }
+            this->work(w);
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                if(--running_ == 0) {done_.notify_all();}
+            }
+        }
+    }
+
+    void work(const std::size_t w)
+    {
+        std::size_t task;
+        while(this->pop(w, task))
+        {
+            try
+            {
+                job_(task, w);
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                if(!error_) {error_ = std::current_exception();}
+            }
+        }
+        return;
+    }
+
+    // take a task from the head of its own queue, or the tail of the others.
+    // no task is added while running, so once all the queues become empty
+    // they remain empty.
+    bool pop(const std::size_t w, std::size_t& task)
+    {
+        {
+            task_queue& own = *queues_[w];
+            std::lock_guard<std::mutex> lock(own.mtx);
+            if(!own.tasks.empty())
+            {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        for(std::size_t i=1; i<queues_.size(); ++i)
+        {
+            task_queue& victim = *queues_[(w + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mtx);
+            if(!victim.tasks.empty())
+            {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+
+    std::vector<std::thread>                  threads_;
+    std::vector<std::unique_ptr<task_queue> > queues_;
+    std::function<void(std::size_t, std::size_t)> job_;
+    std::exception_ptr      error_;
+    std::mutex              mtx_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    std::size_t             generation_;
+    std::size_t             running_;
+    bool                    stop_;
+};
+
+} // perior
+#endif//PERIOR_TREE_THREAD_POOL
@@ -0,0 +1,121 @@
+#ifndef TEST_PERIOR_TREE_RTREE_FIXTURE_HPP
+#define TEST_PERIOR_TREE_RTREE_FIXTURE_HPP
+#include <periortree/rtree.hpp>
+#include <periortree/point.hpp>
+#include <periortree/query.hpp>
+#include <boost/random.hpp>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+// the values and the helpers that the tests of rtree share.
+
+typedef perior::point<double, 3>                    point_type;
+typedef perior::rectangle<point_type>               box_type;
+typedef perior::cubic_periodic_boundary<point_type> boundary_type;
+typedef std::pair<box_type, std::size_t>            value_type;
+
+// coordinates are multiples of 1/8 so that the boxes are exactly representable
+inline point_type random_point(const double L, boost::mt19937& mt)
+{
+    boost::random::uniform_int_distribution<int> pos(0, static_cast<int>(L * 8) - 1);
+    return point_type(pos(mt) / 8.0, pos(mt) / 8.0, pos(mt) / 8.0);
+}
+
+inline double random_radius(boost::mt19937& mt)
+{
+    boost::random::uniform_int_distribution<int> rad(1, 8);
+    return rad(mt) / 8.0;
+}
+
+inline std::vector<value_type>
+generate_values(const std::size_t N, const double L, boost::mt19937& mt)
+{
+    std::vector<value_type> values;
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_type c = random_point(L, mt);
+        const point_type r(random_radius(mt), random_radius(mt), random_radius(mt));
+        values.push_back(value_type(box_type(c, r), i));
+    }
+    return values;
+}
+
+// the box of each value is the bounding box of a sphere.
+inline std::vector<value_type>
+generate_spheres(const std::size_t N, const double L, boost::mt19937& mt)
+{
+    std::vector<value_type> values;
+    for(std::size_t i=0; i<N; ++i)
+    {
+        const point_type c = random_point(L, mt);
+        const double     r = random_radius(mt);
+        values.push_back(value_type(box_type(c, point_type(r, r, r)), i));
+    }
+    return values;
+}
+
+// a cell of L = 20 filled with the values generated from a fixed seed
+struct random_values
+{
+    explicit random_values(const std::size_t N,
+                           const boost::uint32_t seed = 123456789)
+        : L(20.0), boundary(point_type(0., 0., 0.), point_type(L, L, L)),
+          mt(seed), values(generate_values(N, L, mt))
+    {}
+
+    const double            L;
+    const boundary_type     boundary;
+    boost::mt19937          mt;
+    std::vector<value_type> values;
+};
+
+template<typename Tree>
+std::vector<std::size_t> query_ids(const Tree& tree, const box_type& q)
+{
+    std::vector<value_type> found;
+    tree.query(perior::query::intersects_box(q), std::back_inserter(found));
+    std::vector<std::size_t> ids;
+    for(std::size_t i=0; i<found.size(); ++i)
+    {
+        ids.push_back(found[i].second);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+inline std::vector<std::size_t>
+brute_force_ids(const std::vector<value_type>& values, const box_type& q,
+                const boundary_type& b)
+{
+    std::vector<std::size_t> ids;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        if(perior::intersects(values[i].first, q, b))
+        {
+            ids.push_back(values[i].second);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// queries the boxes around every stride-th value of probes, enlarged 3 times,
+// and compares the results with the brute force search over expected.
+template<typename Tree>
+bool matches_brute_force(const Tree& tree, const std::vector<value_type>& probes,
+                         const std::vector<value_type>& expected,
+                         const boundary_type& b, const std::size_t stride = 13)
+{
+    bool ok = true;
+    for(std::size_t i=0; i<probes.size(); i+=stride)
+    {
+        box_type q = probes[i].first;
+        q.radius = q.radius * 3.0;
+        ok = ok && (query_ids(tree, q) == brute_force_ids(expected, q, b));
+    }
+    return ok;
+}
+
+#endif//TEST_PERIOR_TREE_RTREE_FIXTURE_HPP
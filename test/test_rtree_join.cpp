@@ -0,0 +1,256 @@
+#define BOOST_TEST_MODULE "test_rtree_join"
+
+#ifdef UNITTEST_FRAMEWORK_LIBRARY_EXIST
+#include <boost/test/unit_test.hpp>
+#else
+#define BOOST_TEST_NO_LIB
+#include <boost/test/included/unit_test.hpp>
+#endif
+
+#include <test/rtree_fixture.hpp>
+#include <periortree/spatial_join.hpp>
+#include <algorithm>
+#include <vector>
+
+typedef std::pair<std::size_t, std::size_t> id_pair_type;
+typedef perior::rtree<value_type, perior::quadratic<8, 3>, boundary_type>
+        rtree_type;
+
+struct radius_of
+{
+    double operator()(const value_type& v) const {return v.first.radius[0];}
+};
+
+struct pair_collector
+{
+    pair_collector(std::vector<id_pair_type>& p, const boundary_type& b)
+        : pairs(&p), boundary(&b)
+    {}
+
+    void operator()(const value_type& lhs, const value_type& rhs,
+                    const point_type& dr) const
+    {
+        const point_type expected = perior::restrict_direction(
+                rhs.first.center - lhs.first.center, *boundary);
+        BOOST_CHECK(dr == expected);
+        pairs->push_back(std::make_pair(std::min(lhs.second, rhs.second),
+                                        std::max(lhs.second, rhs.second)));
+    }
+
+    std::vector<id_pair_type>* pairs;
+    boundary_type const*       boundary;
+};
+
+template<typename RadiusGetter>
+std::vector<id_pair_type>
+brute_force_pairs(const std::vector<value_type>& values, const double cutoff,
+                  RadiusGetter radius, const boundary_type& b)
+{
+    std::vector<id_pair_type> pairs;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        for(std::size_t j=i+1; j<values.size(); ++j)
+        {
+            const double threshold = radius(values[i]) + radius(values[j]) + cutoff;
+            if(perior::distance_sq(values[i].first.center, values[j].first.center,
+                                   b) <= threshold * threshold)
+            {
+                pairs.push_back(std::make_pair(values[i].second, values[j].second));
+            }
+        }
+    }
+    return pairs;
+}
+
+BOOST_AUTO_TEST_CASE(test_for_each_pair_within)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::vector<value_type> values = generate_spheres(1500, L, mt);
+    rtree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+    const rtree_type packed(values.begin(), values.end(), boundary);
+
+    const double cutoffs[3] = {0.5, 1.25, 3.0};
+    for(std::size_t i=0; i<3; ++i)
+    {
+        const std::vector<id_pair_type> expected = brute_force_pairs(values,
+                cutoffs[i], perior::detail::zero_radius<double>(), boundary);
+
+        std::vector<id_pair_type> pairs;
+        tree.for_each_pair_within(cutoffs[i], pair_collector(pairs, boundary));
+        std::sort(pairs.begin(), pairs.end());
+        BOOST_CHECK(pairs == expected);
+
+        pairs.clear();
+        packed.for_each_pair_within(cutoffs[i], pair_collector(pairs, boundary));
+        std::sort(pairs.begin(), pairs.end());
+        BOOST_CHECK(pairs == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_for_each_pair_within_radius)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(987654321);
+
+    const std::vector<value_type> values = generate_spheres(1500, L, mt);
+    const rtree_type tree(values.begin(), values.end(), boundary);
+
+    const double skins[2] = {0.0, 0.25};
+    for(std::size_t i=0; i<2; ++i)
+    {
+        const std::vector<id_pair_type> expected =
+            brute_force_pairs(values, skins[i], radius_of(), boundary);
+        BOOST_CHECK(!expected.empty());
+
+        std::vector<id_pair_type> pairs;
+        tree.for_each_pair_within(skins[i], radius_of(),
+                                  pair_collector(pairs, boundary));
+        std::sort(pairs.begin(), pairs.end());
+        BOOST_CHECK(pairs == expected);
+    }
+}
+
+// the radius of a removed value must not be asked for.
+struct alive_radius_of
+{
+    alive_radius_of(const std::vector<bool>& r, bool& ok): removed(&r), ok(&ok) {}
+
+    double operator()(const value_type& v) const
+    {
+        if(removed->at(v.second)) {*ok = false;}
+        return v.first.radius[0];
+    }
+
+    std::vector<bool> const* removed;
+    bool*                    ok;
+};
+
+BOOST_AUTO_TEST_CASE(test_for_each_pair_within_removed)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::vector<value_type> values = generate_spheres(1500, L, mt);
+    rtree_type tree(boundary), lazy(boundary);
+    lazy.set_lazy_removal(true, 2);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+        lazy.insert(values[i]);
+    }
+    std::vector<bool> removed(values.size(), false);
+    std::vector<value_type> remaining;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        if(i % 3 == 0)
+        {
+            tree.remove(values[i]);
+            lazy.remove(values[i]);
+            removed[i] = true;
+        }
+        else
+        {
+            remaining.push_back(values[i]);
+        }
+    }
+    BOOST_CHECK(lazy.num_dead() > 0u);
+
+    const std::vector<id_pair_type> expected =
+        brute_force_pairs(remaining, 0.25, radius_of(), boundary);
+    bool ok = true;
+    std::vector<id_pair_type> pairs;
+    tree.for_each_pair_within(0.25, alive_radius_of(removed, ok),
+                              pair_collector(pairs, boundary));
+    std::sort(pairs.begin(), pairs.end());
+    BOOST_CHECK(pairs == expected);
+
+    pairs.clear();
+    lazy.for_each_pair_within(0.25, alive_radius_of(removed, ok),
+                              pair_collector(pairs, boundary));
+    std::sort(pairs.begin(), pairs.end());
+    BOOST_CHECK(pairs == expected);
+    BOOST_CHECK(ok);
+}
+
+BOOST_AUTO_TEST_CASE(test_spatial_join)
+{
+    typedef perior::rtree<value_type, perior::rstar<16>, boundary_type> solvent_tree_type;
+
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::vector<value_type> solute  = generate_spheres( 300, L, mt);
+    const std::vector<value_type> solvent = generate_spheres(3000, L, mt);
+
+    rtree_type solute_tree(boundary);
+    for(std::size_t i=0; i<solute.size(); ++i)
+    {
+        solute_tree.insert(solute[i]);
+    }
+    solvent_tree_type solvent_tree(boundary);
+    for(std::size_t i=0; i<solvent.size(); ++i)
+    {
+        solvent_tree.insert(solvent[i]);
+    }
+
+    std::vector<id_pair_type> expected;
+    for(std::size_t i=0; i<solute.size(); ++i)
+    {
+        for(std::size_t j=0; j<solvent.size(); ++j)
+        {
+            if(perior::intersects(solute[i].first, solvent[j].first, boundary))
+            {
+                expected.push_back(std::make_pair(solute[i].second, solvent[j].second));
+            }
+        }
+    }
+    BOOST_CHECK(!expected.empty());
+
+    std::vector<std::pair<value_type, value_type> > values;
+    perior::spatial_join(solute_tree, solvent_tree, std::back_inserter(values));
+    std::vector<id_pair_type> found;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        found.push_back(std::make_pair(values[i].first.second, values[i].second.second));
+    }
+    std::sort(found.begin(), found.end());
+    BOOST_CHECK(found == expected);
+
+    std::vector<id_pair_type> indices;
+    perior::spatial_join(solute_tree, solvent_tree, std::back_inserter(indices),
+                         perior::index_pairs());
+    found.clear();
+    for(std::size_t i=0; i<indices.size(); ++i)
+    {
+        found.push_back(std::make_pair(solute_tree.at(indices[i].first).second,
+                                       solvent_tree.at(indices[i].second).second));
+    }
+    std::sort(found.begin(), found.end());
+    BOOST_CHECK(found == expected);
+
+    // the trees of different heights, in the opposite order
+    const rtree_type small_tree(solute.begin(), solute.begin() + 5, boundary);
+    std::vector<std::pair<value_type, value_type> > swapped;
+    perior::spatial_join(solvent_tree, small_tree, std::back_inserter(swapped));
+    std::size_t count = 0;
+    for(std::size_t i=0; i<expected.size(); ++i)
+    {
+        if(expected[i].first < 5) {++count;}
+    }
+    BOOST_CHECK_EQUAL(swapped.size(), count);
+
+    const rtree_type empty(boundary);
+    values.clear();
+    perior::spatial_join(empty, solvent_tree, std::back_inserter(values));
+    BOOST_CHECK(values.empty());
+}
@@ -0,0 +1,171 @@
+#define BOOST_TEST_MODULE "test_rtree_packing"
+
+#ifdef UNITTEST_FRAMEWORK_LIBRARY_EXIST
+#include <boost/test/unit_test.hpp>
+#else
+#define BOOST_TEST_NO_LIB
+#include <boost/test/included/unit_test.hpp>
+#endif
+
+#include <test/rtree_fixture.hpp>
+#include <vector>
+
+typedef perior::rtree<value_type, perior::quadratic<8, 3>, boundary_type>
+        rtree_type;
+
+template<typename Packing>
+void check_packing(const Packing& packing)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::size_t sizes[] = {0, 1, 3, 8, 9, 50, 1000};
+    for(std::size_t s=0; s<7; ++s)
+    {
+        const std::vector<value_type> values = generate_values(sizes[s], L, mt);
+        const rtree_type tree(values.begin(), values.end(), boundary, packing);
+
+        BOOST_CHECK(tree.is_valid());
+        BOOST_CHECK_EQUAL(tree.size(), values.size());
+        BOOST_CHECK_EQUAL(tree.empty(), values.empty());
+
+        BOOST_CHECK(matches_brute_force(tree, values, values, boundary, 7));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_str_packing)
+{
+    check_packing(perior::str_packing());
+}
+
+BOOST_AUTO_TEST_CASE(test_hilbert_packing)
+{
+    check_packing(perior::hilbert_packing());
+}
+
+BOOST_AUTO_TEST_CASE(test_morton_packing)
+{
+    check_packing(perior::morton_packing());
+}
+
+BOOST_AUTO_TEST_CASE(test_parallel_str_packing)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::size_t sizes[] = {0, 5, 100, 3000, 20000};
+    const std::size_t threads[] = {2, 3, 4, 8};
+    for(std::size_t s=0; s<5; ++s)
+    {
+        const std::vector<value_type> values = generate_values(sizes[s], L, mt);
+        const rtree_type serial(values.begin(), values.end(), boundary);
+        for(std::size_t t=0; t<4; ++t)
+        {
+            const rtree_type tree(values.begin(), values.end(), boundary,
+                                  perior::str_packing(threads[t]));
+            BOOST_CHECK(tree.is_valid());
+            BOOST_CHECK_EQUAL(tree.size(), values.size());
+
+            for(std::size_t i=0; i<values.size(); i+=97)
+            {
+                box_type q = values[i].first;
+                q.radius = q.radius * 3.0;
+                BOOST_CHECK(query_ids(tree, q) == query_ids(serial, q));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_hilbert_curve_adjacency)
+{
+    // consecutive cells along the hilbert curve are always adjacent.
+    const std::size_t bits = 4;
+    std::vector<std::pair<boost::uint64_t, boost::array<boost::uint32_t, 2> > > cells;
+    for(boost::uint32_t x=0; x < (1u << bits); ++x)
+    {
+        for(boost::uint32_t y=0; y < (1u << bits); ++y)
+        {
+            boost::array<boost::uint32_t, 2> c = {{x, y}};
+            boost::array<boost::uint32_t, 2> t = c;
+            perior::detail::hilbert_transpose(t, bits);
+            cells.push_back(std::make_pair(perior::detail::interleave_bits(t, bits), c));
+        }
+    }
+    std::sort(cells.begin(), cells.end());
+    for(std::size_t i=0; i<cells.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(cells[i].first, i);
+    }
+    for(std::size_t i=1; i<cells.size(); ++i)
+    {
+        const int dx = static_cast<int>(cells[i].second[0]) - static_cast<int>(cells[i-1].second[0]);
+        const int dy = static_cast<int>(cells[i].second[1]) - static_cast<int>(cells[i-1].second[1]);
+        BOOST_CHECK_EQUAL(std::abs(dx) + std::abs(dy), 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_curve_origin_in_gap)
+{
+    // the values lie in [16, 20) and [0, 4). the curve should start after
+    // the empty region in the middle of the cell.
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+
+    std::vector<std::pair<point_type, std::size_t> > entries;
+    for(std::size_t i=0; i<64; ++i)
+    {
+        const double x = (i % 2 == 0) ? (i % 32) / 8.0 : L - (i % 32) / 8.0 - 0.125;
+        entries.push_back(std::make_pair(point_type(x, i * 0.25, 1.0), i));
+    }
+    const perior::detail::curve_grid<point_type> grid =
+        perior::detail::make_curve_grid(entries.begin(), entries.end(), boundary);
+    BOOST_CHECK(4.0 <= grid.origin[0] && grid.origin[0] <= 16.0);
+}
+
+BOOST_AUTO_TEST_CASE(test_str_packing_then_modify)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(987654321);
+
+    std::vector<value_type> values = generate_values(500, L, mt);
+    rtree_type tree(boundary);
+    tree.assign(values.begin(), values.begin() + 400);
+    BOOST_CHECK(tree.is_valid());
+
+    for(std::size_t i=400; i<500; ++i)
+    {
+        tree.insert(values[i]);
+    }
+    BOOST_CHECK(tree.is_valid());
+
+    BOOST_CHECK(matches_brute_force(tree, values, values, boundary, 11));
+}
+
+BOOST_AUTO_TEST_CASE(test_str_packing_across_boundary)
+{
+    // all the values gather around the boundary of the cell.
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+
+    std::vector<value_type> values;
+    for(std::size_t i=0; i<200; ++i)
+    {
+        const double x = (i % 2 == 0) ? (i % 16) / 8.0 : L - (i % 16) / 8.0 - 0.125;
+        const double y = (i % 40) / 2.0;
+        const double z = (i % 13) * 1.5;
+        values.push_back(value_type(box_type(point_type(x, y, z),
+                        point_type(0.125, 0.125, 0.125)), i));
+    }
+    const rtree_type tree(values.begin(), values.end(), boundary);
+    BOOST_CHECK(tree.is_valid());
+
+    for(std::size_t i=0; i<values.size(); i+=3)
+    {
+        box_type q = values[i].first;
+        q.radius = point_type(1.0, 1.0, 1.0);
+        BOOST_CHECK(query_ids(tree, q) == brute_force_ids(values, q, boundary));
+    }
+}
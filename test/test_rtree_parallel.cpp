@@ -0,0 +1,147 @@
+#define BOOST_TEST_MODULE "test_rtree_parallel"
+
+#ifdef UNITTEST_FRAMEWORK_LIBRARY_EXIST
+#include <boost/test/unit_test.hpp>
+#else
+#define BOOST_TEST_NO_LIB
+#include <boost/test/included/unit_test.hpp>
+#endif
+
+#include <test/rtree_fixture.hpp>
+#include <periortree/thread_pool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+typedef perior::rtree<value_type, perior::quadratic<8, 3>, boundary_type>
+        rtree_type;
+typedef perior::query::query_intersects_box<point_type> box_query;
+
+std::vector<box_query>
+generate_queries(const std::vector<value_type>& values)
+{
+    std::vector<box_query> queries;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        box_type q = values[i].first;
+        q.radius = q.radius * 2.0;
+        queries.push_back(perior::query::intersects_box(q));
+    }
+    return queries;
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent_const_query)
+{
+    const random_values data(3000);
+    const std::vector<value_type>& values  = data.values;
+    const std::vector<box_query>   queries = generate_queries(values);
+    rtree_type tree(data.boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+
+    std::vector<std::vector<value_type> > expected(queries.size());
+    for(std::size_t i=0; i<queries.size(); ++i)
+    {
+        tree.query(queries[i], std::back_inserter(expected[i]));
+    }
+
+    // every thread runs all the queries on the same tree at the same time
+    const std::size_t num_threads = 4;
+    std::vector<std::size_t> mismatches(num_threads, 0);
+    std::vector<std::thread> threads;
+    const rtree_type& ctree = tree;
+    for(std::size_t t=0; t<num_threads; ++t)
+    {
+        threads.emplace_back([&, t]{
+            for(std::size_t i=0; i<queries.size(); ++i)
+            {
+                std::vector<value_type> found;
+                ctree.query(queries[i], std::back_inserter(found));
+                if(found != expected[i] ||
+                   ctree.count(queries[i]) != expected[i].size())
+                {
+                    ++mismatches[t];
+                }
+            }
+        });
+    }
+    for(auto& t : threads) {t.join();}
+    for(std::size_t t=0; t<num_threads; ++t)
+    {
+        BOOST_CHECK_EQUAL(mismatches[t], 0u);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_parallel_query_batch)
+{
+    const random_values data(3000);
+    const std::vector<value_type>& values  = data.values;
+    const std::vector<box_query>   queries = generate_queries(values);
+    const rtree_type tree(values.begin(), values.end(), data.boundary);
+
+    perior::query::batch_result serial;
+    tree.query_batch(queries.begin(), queries.end(), serial);
+
+    const std::size_t threads[4] = {1, 2, 3, 8};
+    for(std::size_t i=0; i<4; ++i)
+    {
+        perior::query::batch_result parallel;
+        tree.parallel_query_batch(queries.begin(), queries.end(), parallel,
+                                  threads[i]);
+        BOOST_CHECK(parallel.offsets == serial.offsets);
+        BOOST_CHECK(parallel.indices == serial.indices);
+    }
+
+    // reuse a pool
+    perior::thread_pool pool(4);
+    for(std::size_t i=0; i<3; ++i)
+    {
+        perior::query::batch_result parallel;
+        tree.parallel_query_batch(queries.begin(), queries.end(), parallel, pool);
+        BOOST_CHECK(parallel.offsets == serial.offsets);
+        BOOST_CHECK(parallel.indices == serial.indices);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_thread_pool)
+{
+    perior::thread_pool pool(4);
+    BOOST_CHECK_EQUAL(pool.size(), 4u);
+
+    // Boost.Test is not thread-safe. check the results after run().
+    std::vector<std::atomic<int> > done(1000);
+    for(std::size_t i=0; i<done.size(); ++i) {done[i] = 0;}
+    std::atomic<std::size_t> max_worker(0);
+    pool.run(done.size(), [&](const std::size_t task, const std::size_t worker) {
+        std::size_t prev = max_worker.load();
+        while(prev < worker && !max_worker.compare_exchange_weak(prev, worker)) {}
+        ++done[task];
+    });
+    BOOST_CHECK_LT(max_worker.load(), 4u);
+    for(std::size_t i=0; i<done.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(done[i].load(), 1);
+    }
+
+    // uneven tasks: stolen tasks are still run exactly once
+    std::atomic<std::size_t> sum(0);
+    pool.run(100, [&](const std::size_t task, const std::size_t) {
+        if(task < 25) {std::this_thread::sleep_for(std::chrono::milliseconds(1));}
+        sum += task;
+    });
+    BOOST_CHECK_EQUAL(sum.load(), 4950u);
+
+    BOOST_CHECK_THROW(pool.run(10, [](const std::size_t task, const std::size_t) {
+            if(task == 7) {throw std::runtime_error("error");}
+        }), std::runtime_error);
+
+    // the pool is still usable
+    sum = 0;
+    pool.run(0, [&](const std::size_t, const std::size_t) {++sum;});
+    pool.run(3, [&](const std::size_t, const std::size_t) {++sum;});
+    BOOST_CHECK_EQUAL(sum.load(), 3u);
+}
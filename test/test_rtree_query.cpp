@@ -0,0 +1,536 @@
+#define BOOST_TEST_MODULE "test_rtree_query"
+
+#ifdef UNITTEST_FRAMEWORK_LIBRARY_EXIST
+#include <boost/test/unit_test.hpp>
+#else
+#define BOOST_TEST_NO_LIB
+#include <boost/test/included/unit_test.hpp>
+#endif
+
+#include <test/rtree_fixture.hpp>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <cmath>
+
+typedef perior::rtree<value_type, perior::quadratic<8, 3>, boundary_type>
+        rtree_type;
+
+template<typename Tree, typename Boundary>
+void check_nearest(const Tree& tree, const std::vector<value_type>& values,
+                   const point_type& p, const std::size_t k, const Boundary& b)
+{
+    typedef std::pair<value_type, double> result_type;
+    std::vector<result_type> found;
+    tree.query(perior::query::nearest(p, k), std::back_inserter(found));
+    BOOST_CHECK_EQUAL(found.size(), std::min(k, values.size()));
+
+    std::vector<double> expected;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        expected.push_back(std::sqrt(perior::distance_sq(p, values[i].first, b)));
+    }
+    std::sort(expected.begin(), expected.end());
+
+    for(std::size_t i=0; i<found.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(found[i].second, expected.at(i));
+        BOOST_CHECK_EQUAL(found[i].second,
+                std::sqrt(perior::distance_sq(p, found[i].first.first, b)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_nearest)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::vector<value_type> values = generate_values(2000, L, mt);
+    rtree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+    const rtree_type packed(values.begin(), values.end(), boundary);
+
+    for(std::size_t i=0; i<50; ++i)
+    {
+        const point_type p = random_point(L, mt);
+        check_nearest(tree,   values, p, 1,  boundary);
+        check_nearest(tree,   values, p, 10, boundary);
+        check_nearest(packed, values, p, 25, boundary);
+    }
+    // k larger than the number of values
+    std::vector<std::pair<value_type, double> > all;
+    tree.query(perior::query::nearest(point_type(0., 0., 0.), 5000),
+               std::back_inserter(all));
+    BOOST_CHECK_EQUAL(all.size(), values.size());
+
+    const rtree_type empty(boundary);
+    all.clear();
+    empty.query(perior::query::nearest(point_type(0., 0., 0.), 5),
+                std::back_inserter(all));
+    BOOST_CHECK(all.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_nearest_across_boundary)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    const point_type r(0.125, 0.125, 0.125);
+
+    std::vector<value_type> values;
+    values.push_back(value_type(box_type(point_type(19.5, 5., 5.), r), 0));
+    values.push_back(value_type(box_type(point_type( 3.0, 5., 5.), r), 1));
+    values.push_back(value_type(box_type(point_type(10.0, 5., 5.), r), 2));
+    rtree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+
+    std::vector<std::pair<value_type, double> > found;
+    tree.query(perior::query::nearest(point_type(0.5, 5., 5.), 2),
+               std::back_inserter(found));
+    BOOST_REQUIRE_EQUAL(found.size(), 2u);
+    BOOST_CHECK_EQUAL(found[0].first.second, 0u);
+    BOOST_CHECK_EQUAL(found[0].second, 0.875);
+    BOOST_CHECK_EQUAL(found[1].first.second, 1u);
+    BOOST_CHECK_EQUAL(found[1].second, 2.375);
+}
+
+BOOST_AUTO_TEST_CASE(test_nearest_unlimited)
+{
+    typedef perior::unlimited_boundary<point_type> unlimited_type;
+    typedef perior::rtree<value_type, perior::rstar<8>, unlimited_type> tree_type;
+
+    const unlimited_type boundary;
+    boost::mt19937 mt(987654321);
+    const std::vector<value_type> values = generate_values(1000, 20.0, mt);
+    tree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+    for(std::size_t i=0; i<20; ++i)
+    {
+        check_nearest(tree, values, random_point(30.0, mt), 8, boundary);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_within_distance)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::vector<value_type> values = generate_values(2000, L, mt);
+    rtree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+
+    for(std::size_t i=0; i<50; ++i)
+    {
+        const point_type p = random_point(L, mt);
+        const double     r = 0.5 + (i % 8) * 0.5;
+
+        std::vector<value_type> found, cube;
+        tree.query(perior::query::within_distance(p, r), std::back_inserter(found));
+        const perior::query::query_within_distance<point_type> q(p, r);
+        tree.query(perior::query::intersects_box(q.box()), std::back_inserter(cube));
+
+        std::vector<std::size_t> ids, expected;
+        for(std::size_t j=0; j<found.size(); ++j)
+        {
+            ids.push_back(found[j].second);
+        }
+        for(std::size_t j=0; j<values.size(); ++j)
+        {
+            if(perior::distance_sq(p, values[j].first, boundary) <= r * r)
+            {
+                expected.push_back(values[j].second);
+            }
+        }
+        std::sort(ids.begin(), ids.end());
+        BOOST_CHECK(ids == expected);
+        BOOST_CHECK_LE(found.size(), cube.size());
+    }
+}
+
+template<typename Query>
+void check_query_iterator(const rtree_type& tree, const Query& q)
+{
+    std::vector<value_type> expected;
+    tree.query(q, std::back_inserter(expected));
+
+    typedef typename rtree_type::template const_query_iterator<Query> iterator;
+    BOOST_STATIC_ASSERT((boost::is_same<
+        typename std::iterator_traits<iterator>::iterator_category,
+        std::input_iterator_tag>::value));
+
+    std::vector<value_type> found;
+    for(iterator i(tree.qbegin(q)); i != tree.qend(); ++i)
+    {
+        found.push_back(*i);
+    }
+    BOOST_CHECK(found == expected);
+
+    // the end iterator of the same type for <algorithm>
+    BOOST_CHECK_EQUAL(static_cast<std::size_t>(
+                std::distance(tree.qbegin(q), tree.qend(q))), expected.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_query_iterator)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::vector<value_type> values = generate_values(2000, L, mt);
+    rtree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+
+    for(std::size_t i=0; i<values.size(); i+=37)
+    {
+        box_type q = values[i].first;
+        q.radius = q.radius * 4.0;
+        check_query_iterator(tree, perior::query::intersects_box(q));
+        check_query_iterator(tree, perior::query::within_box(q));
+        check_query_iterator(tree, perior::query::within_distance(q.center, 2.0));
+    }
+
+    // stop after the first hit
+    const box_type everything(point_type(10., 10., 10.), point_type(10., 10., 10.));
+    rtree_type::const_query_iterator<perior::query::query_intersects_box<point_type> >
+        first = tree.qbegin(perior::query::intersects_box(everything));
+    BOOST_CHECK(first != tree.qend());
+    BOOST_CHECK(first->first.radius[0] > 0.0);
+
+    const rtree_type empty(boundary);
+    BOOST_CHECK(empty.qbegin(perior::query::intersects_box(everything)) == empty.qend());
+}
+
+struct stop_after
+{
+    stop_after(const rtree_type& t, const std::size_t n, std::vector<value_type>& v)
+        : tree(&t), limit(n), visited(&v)
+    {}
+
+    bool operator()(const value_type& v, const std::size_t idx) const
+    {
+        BOOST_CHECK(tree->at(idx) == v);
+        visited->push_back(v);
+        return visited->size() < limit;
+    }
+
+    rtree_type const*        tree;
+    std::size_t              limit;
+    std::vector<value_type>* visited;
+};
+
+BOOST_AUTO_TEST_CASE(test_query_visit)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::vector<value_type> values = generate_values(2000, L, mt);
+    const rtree_type tree(values.begin(), values.end(), boundary);
+
+    for(std::size_t i=0; i<values.size(); i+=37)
+    {
+        box_type q = values[i].first;
+        q.radius = q.radius * 4.0;
+
+        std::vector<value_type> expected;
+        tree.query(perior::query::intersects_box(q), std::back_inserter(expected));
+
+        std::vector<value_type> visited;
+        const bool completed = tree.query_visit(perior::query::intersects_box(q),
+                stop_after(tree, values.size(), visited));
+        BOOST_CHECK(completed);
+        BOOST_CHECK(visited == expected);
+
+        // stop at the third value
+        visited.clear();
+        const bool stopped = !tree.query_visit(perior::query::intersects_box(q),
+                stop_after(tree, 3, visited));
+        BOOST_CHECK_EQUAL(stopped, expected.size() >= 3);
+        BOOST_CHECK_EQUAL(visited.size(), std::min<std::size_t>(3, expected.size()));
+        BOOST_CHECK(std::equal(visited.begin(), visited.end(), expected.begin()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_exists_count)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::vector<value_type> values = generate_values(500, L, mt);
+    rtree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+
+    std::size_t num_empty = 0;
+    for(std::size_t i=0; i<200; ++i)
+    {
+        const box_type q(random_point(L, mt), point_type(0.25, 0.25, 0.25));
+
+        std::vector<value_type> found;
+        tree.query(perior::query::intersects_box(q), std::back_inserter(found));
+        BOOST_CHECK_EQUAL(tree.count(perior::query::intersects_box(q)), found.size());
+        BOOST_CHECK_EQUAL(tree.exists(perior::query::intersects_box(q)), !found.empty());
+
+        found.clear();
+        tree.query(perior::query::within_distance(q.center, 1.0),
+                   std::back_inserter(found));
+        BOOST_CHECK_EQUAL(tree.count(perior::query::within_distance(q.center, 1.0)),
+                          found.size());
+        if(found.empty()) {++num_empty;}
+    }
+    BOOST_CHECK(num_empty > 0); // both branches are tested
+
+    const rtree_type empty(boundary);
+    const box_type everything(point_type(10., 10., 10.), point_type(10., 10., 10.));
+    BOOST_CHECK(!empty.exists(perior::query::intersects_box(everything)));
+    BOOST_CHECK_EQUAL(empty.count(perior::query::intersects_box(everything)), 0u);
+    BOOST_CHECK_EQUAL(tree.count(perior::query::intersects_box(everything)),
+                      values.size());
+}
+
+template<typename Query>
+void check_query_batch(const rtree_type& tree, const std::vector<Query>& queries)
+{
+    perior::query::batch_result result;
+    tree.query_batch(queries.begin(), queries.end(), result);
+    BOOST_REQUIRE_EQUAL(result.size(), queries.size());
+    BOOST_CHECK_EQUAL(result.offsets.back(), result.indices.size());
+
+    for(std::size_t i=0; i<queries.size(); ++i)
+    {
+        std::vector<value_type> expected, found;
+        tree.query(queries[i], std::back_inserter(expected));
+        for(std::size_t j=result.offsets[i]; j<result.offsets[i+1]; ++j)
+        {
+            found.push_back(tree.at(result.indices[j]));
+        }
+        // the values are in the same order as query() visits them
+        BOOST_CHECK(found == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_query_batch)
+{
+    typedef perior::query::query_intersects_box<point_type>  box_query;
+    typedef perior::query::query_within_distance<point_type> sphere_query;
+
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    const std::vector<value_type> values = generate_values(2000, L, mt);
+    rtree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+
+    // more than one group, the last one is not full
+    std::vector<box_query>    boxes;
+    std::vector<sphere_query> spheres;
+    for(std::size_t i=0; i<300; ++i)
+    {
+        const point_type p = random_point(L, mt);
+        boxes.push_back(perior::query::intersects_box(
+                    box_type(p, point_type(0.5, 0.75, 1.0))));
+        spheres.push_back(perior::query::within_distance(p, 1.5));
+    }
+    check_query_batch(tree, boxes);
+    check_query_batch(tree, spheres);
+
+    perior::query::batch_result result;
+    tree.query_batch(boxes.begin(), boxes.begin(), result);
+    BOOST_CHECK_EQUAL(result.size(), 0u);
+    BOOST_CHECK(result.indices.empty());
+}
+
+template<typename BoxScalar, typename Boundary>
+void check_entry_masks(const Boundary& boundary, const double L,
+                       const double offset, boost::mt19937& mt)
+{
+    typedef perior::detail::rtree_node<point_type, 3, 8, BoxScalar> node_type;
+    boost::random::uniform_int_distribution<std::size_t> num(0, 8);
+
+    for(std::size_t trial=0; trial<400; ++trial)
+    {
+        std::vector<value_type> values = generate_values(num(mt), L, mt);
+        for(std::size_t k=0; k<values.size(); ++k)
+        {
+            values[k].first.center += point_type(offset, offset, offset);
+        }
+        node_type node(true, 0);
+        for(std::size_t k=0; k<values.size(); ++k)
+        {
+            node.entry.push_back(k);
+            node.set_entry_box(k, values[k].first);
+        }
+
+        // every other query touches one of the boxes, within the rounding
+        point_type p = random_point(L, mt) + point_type(offset, offset, offset);
+        const point_type radius(0.5, 1.25, 2.0);
+        const double r = 1.5;
+        if(trial % 2 == 1 && !values.empty())
+        {
+            const box_type& touched = values[trial % values.size()].first;
+            p = touched.center;
+            p[0] += touched.radius[0] + radius[0];
+        }
+        const box_type rect(p, radius);
+        point_type q = p;
+        if(trial % 2 == 1 && !values.empty())
+        {
+            q[0] += r - radius[0];
+        }
+
+        const perior::detail::kernel_box<node_type>    kbox(rect, boundary);
+        const perior::detail::kernel_sphere<node_type> ksphere(q, r * r, boundary);
+        perior::detail::entry_mask_type sure_hit, sure_near;
+        const perior::detail::entry_mask_type hit =
+            perior::detail::intersects_mask(node, kbox, boundary, sure_hit);
+        const perior::detail::entry_mask_type near =
+            perior::detail::within_distance_mask(node, ksphere, boundary, sure_near);
+        BOOST_CHECK_EQUAL(hit  >> values.size(), 0u);
+        BOOST_CHECK_EQUAL(near >> values.size(), 0u);
+        for(std::size_t k=0; k<values.size(); ++k)
+        {
+            const bool hit_k  = ((hit  >> k) & 1u) == 1u;
+            const bool near_k = ((near >> k) & 1u) == 1u;
+            const bool sure_hit_k  = ((sure_hit  >> k) & 1u) == 1u;
+            const bool sure_near_k = ((sure_near >> k) & 1u) == 1u;
+            if(node_type::exact_boxes)
+            {
+                BOOST_CHECK_EQUAL(sure_hit_k,  hit_k);
+                BOOST_CHECK_EQUAL(sure_near_k, near_k);
+                BOOST_CHECK_EQUAL(hit_k,
+                    perior::intersects(node.entry_box(k), rect, boundary));
+                BOOST_CHECK_EQUAL(near_k,
+                    perior::distance_sq(q, node.entry_box(k), boundary) <= r * r);
+            }
+            else // the masks may have more entries, but never miss any.
+            {
+                BOOST_CHECK(!sure_hit_k  || hit_k);
+                BOOST_CHECK(!sure_near_k || near_k);
+                BOOST_CHECK(!sure_hit_k ||
+                    perior::intersects(values[k].first, rect, boundary));
+                BOOST_CHECK(!sure_near_k ||
+                    perior::distance_sq(q, values[k].first, boundary) <= r * r);
+                BOOST_CHECK(hit_k ||
+                    !perior::intersects(values[k].first, rect, boundary));
+                BOOST_CHECK(near_k ||
+                    perior::distance_sq(q, values[k].first, boundary) > r * r);
+            }
+        }
+    }
+    return;
+}
+
+BOOST_AUTO_TEST_CASE(test_entry_masks)
+{
+    const double L = 8.0;
+    boost::mt19937 mt(123456789);
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    const perior::unlimited_boundary<point_type> unlimited;
+    check_entry_masks<double>(boundary,  L, 0.0, mt);
+    check_entry_masks<double>(unlimited, L, 0.0, mt);
+    check_entry_masks<float>(boundary,  L, 0.0, mt);
+    check_entry_masks<float>(unlimited, L, 0.0, mt);
+
+    // the boxes far from the origin are not exact in float
+    const double far = 1e4 + 1.0 / 3.0;
+    const boundary_type shifted(point_type(far, far, far),
+                                point_type(far + L, far + L, far + L));
+    check_entry_masks<float>(shifted,   L, far, mt);
+    check_entry_masks<float>(unlimited, L, far, mt);
+}
+
+template<typename Tree, typename Query>
+void check_query_result(const Tree& tree, const std::vector<value_type>& values,
+                        const Query& q, const boundary_type& boundary)
+{
+    std::vector<value_type> found;
+    tree.query(q, std::back_inserter(found));
+    std::vector<std::size_t> ids, expected;
+    for(std::size_t j=0; j<found.size(); ++j)
+    {
+        ids.push_back(found[j].second);
+    }
+    for(std::size_t j=0; j<values.size(); ++j)
+    {
+        if(q.match(values[j].first, boundary))
+        {
+            expected.push_back(values[j].second);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    BOOST_CHECK(ids == expected);
+    BOOST_CHECK_EQUAL(tree.count(q), expected.size());
+    return;
+}
+
+BOOST_AUTO_TEST_CASE(test_reduced_precision)
+{
+    typedef perior::rtree<value_type,
+            perior::reduced_precision<perior::quadratic<8, 3> >, boundary_type
+            > float_tree_type;
+    typedef perior::rtree<value_type,
+            perior::reduced_precision<perior::rstar<16> >, boundary_type
+            > float_rstar_type;
+    BOOST_STATIC_ASSERT((boost::is_same<
+            float_tree_type::node_type::box_scalar_type, float>::value));
+    BOOST_STATIC_ASSERT((boost::is_same<
+            rtree_type::node_type::box_scalar_type, double>::value));
+
+    // multiples of 1/24 are not exact in float nor in double, so the boxes
+    // are rounded and some of them touch each other within the rounding.
+    const double L = 20.0 / 3.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    boost::mt19937 mt(123456789);
+
+    std::vector<value_type> values = generate_values(2000, 20.0, mt);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        values[i].first.center = values[i].first.center / 3.0;
+        values[i].first.radius = values[i].first.radius / 3.0;
+    }
+
+    float_tree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+    const float_rstar_type packed(values.begin(), values.end(), boundary);
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK(packed.is_valid());
+
+    for(std::size_t i=0; i<100; ++i)
+    {
+        const point_type p = random_point(20.0, mt) / 3.0;
+        const box_type   rect(p, point_type(1., 2., 3.) / 24.0 * (i % 8));
+        const double     r = (i % 8) / 24.0;
+
+        check_query_result(tree,   values, perior::query::intersects_box(rect),  boundary);
+        check_query_result(packed, values, perior::query::intersects_box(rect),  boundary);
+        check_query_result(tree,   values, perior::query::within_box(rect),      boundary);
+        check_query_result(tree,   values, perior::query::within_distance(p, r), boundary);
+        check_query_result(packed, values, perior::query::within_distance(p, r), boundary);
+    }
+}
@@ -0,0 +1,349 @@
+#define BOOST_TEST_MODULE "test_rtree_split"
+
+#ifdef UNITTEST_FRAMEWORK_LIBRARY_EXIST
+#include <boost/test/unit_test.hpp>
+#else
+#define BOOST_TEST_NO_LIB
+#include <boost/test/included/unit_test.hpp>
+#endif
+
+#include <test/rtree_fixture.hpp>
+#include <periortree/spatial_join.hpp>
+#include <boost/mpl/list.hpp>
+#include <vector>
+
+typedef boost::mpl::list<
+    perior::quadratic<6, 2>, perior::quadratic<16>,
+    perior::linear<6, 2>, perior::linear<32>, perior::linear<64, 16>,
+    perior::rstar<6, 2, 2>, perior::rstar<16>, perior::rstar<32>,
+    perior::compact_index<perior::quadratic<6, 2> >,
+    perior::compact_index<perior::rstar<16>, boost::uint16_t>
+    > split_params;
+
+template<typename Params>
+void check_insertion()
+{
+    typedef perior::rtree<value_type, Params, boundary_type> rtree_type;
+
+    const random_values data(3000);
+    const std::vector<value_type>& values = data.values;
+    rtree_type tree(data.boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), values.size());
+    BOOST_CHECK(matches_brute_force(tree, values, values, data.boundary));
+
+    // remove two thirds of the values
+    std::vector<value_type> remaining;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        if(i % 3 == 0)
+        {
+            remaining.push_back(values[i]);
+            continue;
+        }
+        BOOST_CHECK(tree.remove(values[i]));
+    }
+    BOOST_CHECK(!tree.remove(values[1]));
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), remaining.size());
+    BOOST_CHECK(matches_brute_force(tree, values, remaining, data.boundary));
+
+    for(std::size_t i=0; i<remaining.size(); ++i)
+    {
+        BOOST_CHECK(tree.remove(remaining[i]));
+    }
+    BOOST_CHECK(tree.empty());
+    BOOST_CHECK_EQUAL(tree.size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_insertion, Params, split_params)
+{
+    check_insertion<Params>();
+}
+
+typedef boost::mpl::list<
+    perior::quadratic<6, 2>, perior::linear<32>, perior::rstar<16>,
+    perior::compact_index<perior::linear<32> >,
+    perior::compact_index<perior::rstar<16> >
+    > removal_params;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_batch, Params, removal_params)
+{
+    typedef perior::rtree<value_type, Params, boundary_type> rtree_type;
+
+    const random_values data(3000);
+    const std::vector<value_type>& values = data.values;
+    rtree_type tree(data.boundary);
+    tree.insert(values.begin(), values.begin() + 1000);
+    tree.insert(values.begin() + 1000, values.end());
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), values.size());
+    BOOST_CHECK(matches_brute_force(tree, values, values, data.boundary));
+
+    // remove 10% of the values, then most of the rest
+    std::vector<value_type> removed, remaining;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        (i % 10 == 0 ? removed : remaining).push_back(values[i]);
+    }
+    BOOST_CHECK_EQUAL(tree.remove(removed.begin(), removed.end()), removed.size());
+    BOOST_CHECK_EQUAL(tree.remove(removed.begin(), removed.end()), 0u);
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), remaining.size());
+    BOOST_CHECK(matches_brute_force(tree, values, remaining, data.boundary));
+
+    const std::vector<value_type> last(remaining.end() - 5, remaining.end());
+    BOOST_CHECK_EQUAL(tree.remove(remaining.begin(), remaining.end() - 5),
+                      remaining.size() - 5);
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), 5u);
+    for(std::size_t i=0; i<last.size(); ++i)
+    {
+        BOOST_CHECK(query_ids(tree, last[i].first) ==
+                    brute_force_ids(last, last[i].first, data.boundary));
+    }
+
+    BOOST_CHECK_EQUAL(tree.remove(last.begin(), last.end()), last.size());
+    BOOST_CHECK(tree.empty());
+
+    // removing everything from a packed tree
+    rtree_type packed(values.begin(), values.end(), data.boundary);
+    BOOST_CHECK_EQUAL(packed.remove(values.begin(), values.end()), values.size());
+    BOOST_CHECK(packed.empty());
+    packed.insert(values.begin(), values.end());
+    BOOST_CHECK(packed.is_valid());
+    BOOST_CHECK_EQUAL(packed.size(), values.size());
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_lazy_removal, Params, removal_params)
+{
+    typedef perior::rtree<value_type, Params, boundary_type> rtree_type;
+
+    random_values data(3000);
+    std::vector<value_type>& values = data.values;
+    rtree_type tree(data.boundary);
+    tree.set_lazy_removal(true, 2);
+    std::vector<std::size_t> handles;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        handles.push_back(tree.insert(values[i]));
+    }
+
+    // remove and re-add a part of the values repeatedly
+    for(std::size_t step=0; step<4; ++step)
+    {
+        const std::vector<value_type> fresh =
+            generate_values(values.size(), data.L, data.mt);
+        for(std::size_t i=step; i<values.size(); i+=4)
+        {
+            if(i % 2 == 0)
+            {
+                BOOST_CHECK(tree.remove(values[i]));
+                BOOST_CHECK(!tree.remove(values[i]));
+            }
+            else
+            {
+                BOOST_CHECK(tree.remove_handle(handles[i]));
+                BOOST_CHECK(!tree.contains(handles[i]));
+            }
+            values[i] = value_type(fresh[i].first, values[i].second);
+            handles[i] = tree.insert(values[i]);
+        }
+        BOOST_CHECK(tree.is_valid());
+        BOOST_CHECK_EQUAL(tree.size(), values.size());
+        BOOST_CHECK(matches_brute_force(tree, values, values, data.boundary));
+
+        bool counted = true;
+        for(std::size_t i=0; i<values.size(); i+=13)
+        {
+            box_type q = values[i].first;
+            q.radius = q.radius * 3.0;
+            counted = counted && tree.count(perior::query::intersects_box(q)) ==
+                      brute_force_ids(values, q, data.boundary).size();
+        }
+        BOOST_CHECK(counted);
+    }
+
+    // dead values do not appear in joins
+    std::vector<std::pair<std::size_t, std::size_t> > pairs;
+    perior::spatial_join(tree, tree, std::back_inserter(pairs),
+                         perior::index_pairs());
+    bool all_alive = true;
+    for(std::size_t i=0; i<pairs.size(); ++i)
+    {
+        all_alive = all_alive && tree.contains(pairs[i].first) &&
+                                 tree.contains(pairs[i].second);
+    }
+    BOOST_CHECK(all_alive);
+
+    // remove half of them and compact
+    std::vector<value_type> remaining;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        if(i % 2 == 0) {BOOST_CHECK(tree.remove(values[i]));}
+        else           {remaining.push_back(values[i]);}
+    }
+    BOOST_CHECK(tree.num_dead() > 0u);
+    BOOST_CHECK_EQUAL(tree.size(), remaining.size());
+    tree.compact();
+    BOOST_CHECK_EQUAL(tree.num_dead(), 0u);
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), remaining.size());
+    BOOST_CHECK(matches_brute_force(tree, values, remaining, data.boundary));
+
+    // the batch removal also marks the values as dead, and condenses only the
+    // leaves that have too many of them.
+    std::vector<value_type> removed, kept;
+    for(std::size_t i=0; i<remaining.size(); ++i)
+    {
+        if(i % 3 == 0) {removed.push_back(remaining[i]);}
+        else           {kept.push_back(remaining[i]);}
+    }
+    removed.push_back(values.front()); // already removed
+    BOOST_CHECK_EQUAL(tree.remove(removed.begin(), removed.end()),
+                      removed.size() - 1);
+    BOOST_CHECK(tree.num_dead() > 0u);
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), kept.size());
+    BOOST_CHECK(matches_brute_force(tree, values, kept, data.boundary));
+
+    // remove all of them, then disabling lazy removal empties the tree
+    for(std::size_t i=0; i<kept.size(); ++i)
+    {
+        BOOST_CHECK(tree.remove(kept[i]));
+    }
+    BOOST_CHECK(tree.empty());
+    tree.set_lazy_removal(false);
+    BOOST_CHECK(tree.empty());
+    BOOST_CHECK_EQUAL(tree.num_dead(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_compact_index)
+{
+    typedef perior::rtree<value_type,
+            perior::compact_index<perior::quadratic<6, 2>, boost::uint8_t>,
+            boundary_type> rtree_type;
+    BOOST_CHECK_EQUAL(static_cast<std::size_t>(rtree_type::nil), 255u);
+
+    const random_values data(300);
+    const std::vector<value_type>& values = data.values;
+
+    rtree_type tree(data.boundary);
+    std::size_t inserted = 0;
+    try
+    {
+        for(; inserted<values.size(); ++inserted)
+        {
+            tree.insert(values[inserted]);
+        }
+    }
+    catch(const std::length_error&)
+    {
+        // no room for another value
+    }
+    BOOST_CHECK_EQUAL(inserted, 255u);
+    BOOST_CHECK_EQUAL(tree.size(), 255u);
+    BOOST_CHECK(tree.is_valid());
+
+    BOOST_CHECK_THROW(tree.assign(values.begin(), values.end()), std::length_error);
+    BOOST_CHECK(tree.empty());
+    tree.assign(values.begin(), values.begin() + 200);
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), 200u);
+}
+
+typedef boost::mpl::list<
+    perior::cache_fit<8>,
+    perior::cache_fit<16, perior::linear_tag>,
+    perior::cache_fit<16, perior::rstar_tag>,
+    perior::compact_index<perior::cache_fit<8> >,
+    perior::reduced_precision<perior::cache_fit<8, perior::rstar_tag> >,
+    perior::cache_fit<4, perior::quadratic_tag, 128>
+    > cache_fit_params;
+
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_cache_fit, Params, cache_fit_params)
+{
+    typedef perior::rtree<value_type, Params, boundary_type> rtree_type;
+    typedef typename Params::cache_fit_type fit_type;
+    typedef perior::detail::rtree_node<point_type, 1, rtree_type::max_entry + 1,
+            typename rtree_type::node_scalar_type,
+            typename rtree_type::node_index_type, fit_type::line_size
+            > larger_node_type;
+    const std::size_t line_size = fit_type::line_size;
+
+    // the largest node that fits, aligned to the cache lines
+    BOOST_CHECK_LE(static_cast<std::size_t>(rtree_type::node_size),
+                   static_cast<std::size_t>(fit_type::node_bytes));
+    BOOST_CHECK_GT(sizeof(larger_node_type),
+                   static_cast<std::size_t>(fit_type::node_bytes));
+    BOOST_CHECK((boost::is_same<typename rtree_type::algorithm_tag,
+                 typename fit_type::algorithm_tag>::value));
+    BOOST_CHECK_EQUAL(boost::alignment_of<typename rtree_type::node_type>::value,
+                      line_size);
+    BOOST_CHECK_EQUAL(rtree_type::node_size % line_size, 0u);
+
+    check_insertion<Params>();
+
+    // the nodes in the tree start at the lines
+    const random_values data(1000);
+    rtree_type tree(data.boundary);
+    for(std::size_t i=0; i<data.values.size(); ++i)
+    {
+        tree.insert(data.values[i]);
+    }
+    const typename rtree_type::tree_type& nodes =
+        perior::detail::rtree_access::nodes(tree);
+    BOOST_CHECK(nodes.size() > 1u);
+    bool aligned = true;
+    for(std::size_t i=0; i<nodes.size(); ++i)
+    {
+        aligned = aligned &&
+            reinterpret_cast<std::size_t>(&nodes[i]) % line_size == 0;
+    }
+    BOOST_CHECK(aligned);
+}
+
+BOOST_AUTO_TEST_CASE(test_overlap_across_boundary)
+{
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+
+    const box_type lhs(point_type(19.5, 5.0, 5.0), point_type(1.0, 1.0, 1.0));
+    const box_type rhs(point_type( 0.5, 5.0, 5.0), point_type(1.0, 1.0, 1.0));
+    const box_type far(point_type(10.0, 5.0, 5.0), point_type(1.0, 1.0, 1.0));
+    BOOST_CHECK_EQUAL(perior::overlap(lhs, rhs, boundary), 1.0 * 2.0 * 2.0);
+    BOOST_CHECK_EQUAL(perior::overlap(lhs, far, boundary), 0.0);
+    BOOST_CHECK_EQUAL(perior::overlap(lhs, lhs, boundary), 8.0);
+    BOOST_CHECK_EQUAL(perior::margin(lhs, boundary), 6.0);
+
+    BOOST_CHECK_EQUAL(perior::expanded_area(lhs, rhs, boundary),
+                      perior::area(perior::expand(lhs, rhs, boundary), boundary));
+    BOOST_CHECK_EQUAL(perior::expanded_area(lhs, far, boundary),
+                      perior::area(perior::expand(lhs, far, boundary), boundary));
+    BOOST_CHECK_EQUAL(perior::expanded_area(lhs, lhs, boundary), 8.0);
+}
+
+BOOST_AUTO_TEST_CASE(test_linear_seeds_across_boundary)
+{
+    // two clusters, one of them straddles the boundary of the cell.
+    // the seeds should be taken from different clusters.
+    const double L = 20.0;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(L, L, L));
+    const point_type r(0.25, 0.25, 0.25);
+
+    std::vector<std::pair<std::size_t, box_type> > entries;
+    entries.push_back(std::make_pair(0, box_type(point_type(19.5, 5.0, 5.0), r)));
+    entries.push_back(std::make_pair(1, box_type(point_type( 0.5, 5.0, 5.0), r)));
+    entries.push_back(std::make_pair(2, box_type(point_type( 9.5, 5.0, 5.0), r)));
+    entries.push_back(std::make_pair(3, box_type(point_type(10.5, 5.0, 5.0), r)));
+
+    const boost::array<std::size_t, 2> seeds = perior::detail::pick_seeds(
+            entries.begin(), entries.end(), boundary, perior::linear_tag());
+    BOOST_CHECK_NE(seeds[0], seeds[1]);
+    BOOST_CHECK_NE(seeds[0] / 2, seeds[1] / 2);
+}
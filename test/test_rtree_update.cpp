@@ -0,0 +1,299 @@
+#define BOOST_TEST_MODULE "test_rtree_update"
+
+#ifdef UNITTEST_FRAMEWORK_LIBRARY_EXIST
+#include <boost/test/unit_test.hpp>
+#else
+#define BOOST_TEST_NO_LIB
+#include <boost/test/included/unit_test.hpp>
+#endif
+
+#include <test/rtree_fixture.hpp>
+#include <boost/mpl/list.hpp>
+#include <algorithm>
+#include <vector>
+
+typedef boost::mpl::list<
+    perior::quadratic<8, 3>, perior::linear<16>, perior::rstar<16>
+    > update_params;
+
+// move the center by [-max_disp, max_disp] in the unit of 1/8
+value_type displace(const value_type& v, const int max_disp,
+                    const boundary_type& b, boost::mt19937& mt)
+{
+    boost::random::uniform_int_distribution<int> disp(-max_disp, max_disp);
+    value_type moved(v);
+    for(std::size_t j=0; j<3; ++j)
+    {
+        moved.first.center[j] += disp(mt) / 8.0;
+    }
+    moved.first.center = perior::restrict_position(moved.first.center, b);
+    return moved;
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_update, Params, update_params)
+{
+    typedef perior::rtree<value_type, Params, boundary_type> rtree_type;
+
+    random_values data(2000);
+    const boundary_type&     boundary = data.boundary;
+    boost::mt19937&          mt       = data.mt;
+    std::vector<value_type>& values   = data.values;
+    rtree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+
+    // small moves for several steps, then large jumps
+    const int max_disp[4] = {1, 2, 4, 80};
+    for(std::size_t step=0; step<4; ++step)
+    {
+        for(std::size_t i=0; i<values.size(); ++i)
+        {
+            const value_type moved = displace(values[i], max_disp[step], boundary, mt);
+            BOOST_CHECK(tree.update(values[i], moved));
+            values[i] = moved;
+        }
+        BOOST_CHECK(tree.is_valid());
+        BOOST_CHECK_EQUAL(tree.size(), values.size());
+        BOOST_CHECK(matches_brute_force(tree, values, values, boundary, 17));
+    }
+
+    // not found
+    value_type missing = values.front();
+    missing.second = values.size();
+    BOOST_CHECK(!tree.update(missing, values.front()));
+
+    // tree with only one value
+    rtree_type single(boundary);
+    single.insert(values[0]);
+    const value_type moved = displace(values[0], 80, boundary, mt);
+    BOOST_CHECK(single.update(values[0], moved));
+    BOOST_CHECK(single.is_valid());
+    BOOST_CHECK_EQUAL(single.size(), 1u);
+    BOOST_CHECK_EQUAL(single.count(perior::query::intersects_box(moved.first)), 1u);
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_skin, Params, update_params)
+{
+    typedef perior::rtree<value_type, Params, boundary_type> rtree_type;
+
+    random_values data(2000);
+    const boundary_type&     boundary = data.boundary;
+    boost::mt19937&          mt       = data.mt;
+    std::vector<value_type>& values   = data.values;
+    rtree_type tree(boundary);
+    tree.set_skin(0.5);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        tree.insert(values[i]);
+    }
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK(matches_brute_force(tree, values, values, boundary, 17));
+
+    // moves within the skin never escape from the fat boxes
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        const value_type moved = displace(values[i], 2, boundary, mt);
+        BOOST_CHECK(tree.update(values[i], moved));
+        values[i] = moved;
+    }
+    BOOST_CHECK_EQUAL(tree.skin_stats().updates, values.size());
+    BOOST_CHECK_EQUAL(tree.skin_stats().escapes, 0u);
+    BOOST_CHECK(matches_brute_force(tree, values, values, boundary, 17));
+
+    tree.reset_skin_stats();
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        const value_type moved = displace(values[i], 80, boundary, mt);
+        BOOST_CHECK(tree.update(values[i], moved));
+        values[i] = moved;
+    }
+    BOOST_CHECK_EQUAL(tree.skin_stats().updates, values.size());
+    BOOST_CHECK(tree.skin_stats().escapes > 0u);
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), values.size());
+    BOOST_CHECK(matches_brute_force(tree, values, values, boundary, 17));
+
+    // without the exact recheck, the result is a superset of the exact one
+    tree.set_skin(0.5, false);
+    for(std::size_t i=0; i<values.size(); i+=17)
+    {
+        const perior::query::query_intersects_box<point_type> q =
+            perior::query::intersects_box(values[i].first);
+        std::size_t expected = 0;
+        for(std::size_t j=0; j<values.size(); ++j)
+        {
+            if(perior::intersects(values[j].first, values[i].first, boundary))
+            {
+                ++expected;
+            }
+        }
+        BOOST_CHECK(tree.count(q) >= expected);
+    }
+
+    // turning the skin off makes the boxes tight again
+    tree.set_skin(0.0);
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK(matches_brute_force(tree, values, values, boundary, 17));
+
+    // packed tree
+    rtree_type packed(values.begin(), values.end(), boundary);
+    packed.set_skin(0.25);
+    BOOST_CHECK(matches_brute_force(packed, values, values, boundary, 17));
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        const value_type moved = displace(values[i], 4, boundary, mt);
+        BOOST_CHECK(packed.update(values[i], moved));
+        values[i] = moved;
+    }
+    BOOST_CHECK(packed.is_valid());
+    BOOST_CHECK(matches_brute_force(packed, values, values, boundary, 17));
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_handle, Params, update_params)
+{
+    typedef perior::rtree<value_type, Params, boundary_type> rtree_type;
+
+    random_values data(2000);
+    const boundary_type&     boundary = data.boundary;
+    boost::mt19937&          mt       = data.mt;
+    std::vector<value_type>& values   = data.values;
+    std::vector<std::size_t> handles;
+    rtree_type tree(boundary);
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        handles.push_back(tree.insert(values[i]));
+        BOOST_CHECK(tree.contains(handles.back()));
+    }
+    BOOST_CHECK(tree.is_valid());
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        BOOST_CHECK(tree.at(handles[i]) == values[i]);
+    }
+
+    // move the values by the handles
+    const int max_disp[2] = {2, 80};
+    for(std::size_t step=0; step<2; ++step)
+    {
+        for(std::size_t i=0; i<values.size(); ++i)
+        {
+            const value_type moved = displace(values[i], max_disp[step], boundary, mt);
+            BOOST_CHECK(tree.update_handle(handles[i], moved));
+            values[i] = moved;
+        }
+        BOOST_CHECK(tree.is_valid());
+        BOOST_CHECK(matches_brute_force(tree, values, values, boundary, 17));
+    }
+
+    // remove the half of them by the handles
+    std::vector<value_type> remaining;
+    std::vector<std::size_t> remaining_handles;
+    for(std::size_t i=0; i<values.size(); ++i)
+    {
+        if(i % 2 == 0)
+        {
+            BOOST_CHECK(tree.remove_handle(handles[i]));
+            BOOST_CHECK(!tree.contains(handles[i]));
+            BOOST_CHECK(!tree.remove_handle(handles[i]));
+            BOOST_CHECK(!tree.update_handle(handles[i], values[i]));
+        }
+        else
+        {
+            remaining.push_back(values[i]);
+            remaining_handles.push_back(handles[i]);
+        }
+    }
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), remaining.size());
+    BOOST_CHECK(matches_brute_force(tree, remaining, remaining, boundary, 17));
+    for(std::size_t i=0; i<remaining.size(); ++i)
+    {
+        BOOST_CHECK(tree.at(remaining_handles[i]) == remaining[i]);
+    }
+    BOOST_CHECK(!tree.contains(values.size()));
+
+    // the handles of a packed tree are the indices of the values in it
+    rtree_type packed(remaining.begin(), remaining.end(), boundary);
+    BOOST_CHECK(packed.is_valid());
+    for(std::size_t i=0; i<remaining.size(); ++i)
+    {
+        BOOST_CHECK(packed.contains(i));
+        const value_type moved = displace(packed.at(i), 4, boundary, mt);
+        BOOST_CHECK(packed.update_handle(i, moved));
+    }
+    BOOST_CHECK(packed.is_valid());
+    for(std::size_t i=0; i<remaining.size(); ++i)
+    {
+        BOOST_CHECK(packed.remove_handle(i));
+    }
+    BOOST_CHECK(packed.empty());
+}
+
+// the value is an integral id, and its box is computed from the id.
+struct id_box_getter
+{
+    typedef box_type indexable_type;
+
+    box_type operator()(const std::size_t id) const
+    {
+        const point_type center(id % 16 + 0.5, (id / 16) % 16 + 0.5, id / 256 + 0.5);
+        return box_type(center, point_type(0.25, 0.25, 0.25));
+    }
+};
+
+// remove/update take a value and remove_handle/update_handle take a handle.
+// they are not confused even if the value is an integer.
+BOOST_AUTO_TEST_CASE(test_handle_of_integer)
+{
+    typedef perior::rtree<std::size_t, perior::quadratic<8, 3>, boundary_type,
+                          id_box_getter> rtree_type;
+    const boundary_type boundary(point_type(0., 0., 0.), point_type(16., 16., 16.));
+    const std::size_t N = 1000;
+
+    // the handle of the id i is N-1-i
+    rtree_type tree(boundary);
+    for(std::size_t i=0; i<N; ++i)
+    {
+        BOOST_CHECK_EQUAL(tree.insert(N - 1 - i), i);
+    }
+    BOOST_CHECK(tree.is_valid());
+
+    // by value: the id 10, the handle N-11
+    BOOST_CHECK(tree.remove(std::size_t(10)));
+    BOOST_CHECK(!tree.contains(N - 11));
+    BOOST_CHECK(tree.contains(10));
+    BOOST_CHECK_EQUAL(tree.at(10), N - 11);
+
+    // by handle: the handle 20, the id N-21
+    BOOST_CHECK(tree.remove_handle(20));
+    BOOST_CHECK(!tree.contains(20));
+    BOOST_CHECK(!tree.remove(N - 21));
+    BOOST_CHECK(tree.remove(std::size_t(20)));
+    BOOST_CHECK(!tree.contains(N - 21));
+
+    // the id 30 becomes N+30 by value, the handle 40 becomes N+40
+    BOOST_CHECK(tree.update(std::size_t(30), N + 30));
+    BOOST_CHECK(tree.update_handle(40, N + 40));
+    BOOST_CHECK(!tree.update_handle(20, N + 20));
+    BOOST_CHECK(tree.is_valid());
+    BOOST_CHECK_EQUAL(tree.size(), N - 3);
+
+    std::vector<std::size_t> found;
+    tree.query(perior::query::intersects_box(box_type(
+            point_type(8., 8., 8.), point_type(16., 16., 16.))),
+            std::back_inserter(found));
+    std::sort(found.begin(), found.end());
+    std::vector<std::size_t> expected;
+    for(std::size_t i=0; i<N; ++i)
+    {
+        if(i == 10 || i == 20 || i == 30 || i == N - 21 || i == N - 41)
+        {
+            continue;
+        }
+        expected.push_back(i);
+    }
+    expected.push_back(N + 30);
+    expected.push_back(N + 40);
+    BOOST_CHECK(found == expected);
+}